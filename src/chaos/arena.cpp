@@ -0,0 +1,84 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#include "arena.h"
+
+#include <cstdint>
+
+#include "check.h"
+
+namespace arena {
+
+namespace {
+
+constexpr uint32_t kMinShift = __builtin_ctz(kMinChunk);
+constexpr uint32_t kMaxShift = __builtin_ctz(kMaxChunk);
+constexpr uint32_t kNumClasses = kMaxShift - kMinShift + 1;
+
+static_assert((kMinChunk & (kMinChunk - 1)) == 0 && (kMaxChunk & (kMaxChunk - 1)) == 0);
+static_assert(kMinChunk >= sizeof(void *));
+
+// Free chunks are linked through their first bytes.
+struct FreeChunk {
+  FreeChunk *next;
+};
+
+struct SizeClass {
+  FreeChunk *head;
+  uint32_t count;
+};
+
+SizeClass classes[kNumClasses];
+ArenaStats arena_stats;
+
+inline uint32_t ClassOf(uint32_t size) {
+  if (size <= kMinChunk)
+    return 0;
+  return 32 - __builtin_clz(size - 1) - kMinShift;
+}
+
+inline uint32_t ChunkSize(uint32_t cls) {
+  return kMinChunk << cls;
+}
+
+} // namespace
+
+uint8_t *Allocate(uint32_t size) {
+  if (size == 0 || size > kMaxChunk)
+    return nullptr;
+  arena_stats.allocs++;
+  SizeClass &c = classes[ClassOf(size)];
+  if (c.head) {
+    FreeChunk *chunk = c.head;
+    c.head = chunk->next;
+    c.count--;
+    return reinterpret_cast<uint8_t *>(chunk);
+  }
+  arena_stats.system++;
+  return new uint8_t[ChunkSize(ClassOf(size))];
+}
+
+void Release(uint8_t *ptr, uint32_t size) {
+  if (!ptr)
+    return;
+  CHECK(size > 0 && size <= kMaxChunk);
+  SizeClass &c = classes[ClassOf(size)];
+  if (c.count >= kMaxFreeChunks) {
+    arena_stats.returned++;
+    delete[] ptr;
+    return;
+  }
+  FreeChunk *chunk = reinterpret_cast<FreeChunk *>(ptr);
+  chunk->next = c.head;
+  c.head = chunk;
+  c.count++;
+}
+
+const ArenaStats &stats() {
+  return arena_stats;
+}
+
+}
@@ -0,0 +1,40 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <cstdint>
+
+// Number of chunks handed out by the arena, and how many of them had to come from (or went back
+// to) the system allocator. Once warmed up a request leaves system and returned unchanged.
+struct ArenaStats {
+  uint64_t allocs;
+  uint64_t system;
+  uint64_t returned;
+};
+
+// Size-class allocator backing Buffer. Sizes are rounded up to a power of two between
+// kMinChunk and kMaxChunk, and released chunks are kept on the free list of their class for the
+// next request instead of being freed.
+namespace arena {
+
+constexpr uint32_t kMinChunk = 16;
+constexpr uint32_t kMaxChunk = 0x100000;
+// Free chunks kept per class, the rest are freed. Enough for the input, output and keys of a
+// request of the same size.
+constexpr uint32_t kMaxFreeChunks = 8;
+
+// Returns nullptr if @size is 0 or larger than kMaxChunk.
+uint8_t *Allocate(uint32_t size);
+// @size must be the one passed to Allocate().
+void Release(uint8_t *ptr, uint32_t size);
+
+const ArenaStats &stats();
+
+}
+
+#endif // _ARENA_H
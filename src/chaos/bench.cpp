@@ -0,0 +1,971 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+// Drives the sandbox the way QEMU and the guest driver do, without either: hands it the CSR and
+// DRAM memfds and the eventfds, boots the firmware and sends it a mix of requests through the
+// mailbox, then reports throughput and latency percentiles per algorithm and size.
+//
+//   ./bench [options] [-- sandbox options]
+//
+// The requests are either a weighted mix, or those of a capture taken with the --capture option of
+// the sandbox, sent at their captured pace (--replay). A replay can run against two sandbox builds
+// in turn, to compare their latencies under the same load (--against).
+//
+// The sandbox runs in the current directory, which must have flag_firmware and flag_sandbox. The
+// exit status is non-zero if any request failed, gave an inconsistent answer or, with --max-p99,
+// was too slow at the 99th percentile.
+
+#include <getopt.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "capture.h"
+#include "check.h"
+#include "cipher/aes.h"
+#include "cipher/blowfish.h"
+#include "cipher/threefish.h"
+#include "cipher/twofish.h"
+#include "mailbox.h"
+#include "stats.h"
+
+namespace {
+
+constexpr uint32_t kDramSize = 0x100000;
+constexpr uint64_t kVerifiedEvent = 0x1337;
+
+// Where things live in DRAM. The firmware image is loaded at 0 and may be overwritten once booted.
+constexpr uint32_t kCmdqAddr = 0x80000;
+constexpr uint32_t kRspqAddr = kCmdqAddr + kQueueSize * sizeof(MailboxCmd);
+constexpr uint32_t kRequestAddr = 0x84000;
+constexpr uint32_t kSlotAddr = kRequestAddr + kQueueSize * sizeof(Request);
+static_assert(kRspqAddr + kQueueSize * sizeof(MailboxRsp) <= kRequestAddr);
+static_assert(kSlotAddr <= kDramSize);
+
+constexpr int kCsrFd = 3;
+constexpr int kDramFd = 4;
+constexpr int kEventFdToDevice = 5;
+constexpr int kEventFdFromDevice = 6;
+// above the fds the sandbox expects, so moving them there doesn't clobber any
+constexpr int kFirstFd = 16;
+
+// how long the sandbox may stay silent before it is considered hung
+constexpr int kTimeoutMs = 10000;
+
+struct Algo {
+  const char *name;
+  uint32_t key_size;
+  // inputs must be multiples of it
+  uint32_t block_size;
+  // fixed output size of digests, 0 if the output is as long as the input
+  uint32_t digest_size;
+};
+
+// indexed by enum chaos_request_algo
+const Algo kAlgos[] = {
+  { "echo", 0, 1, 0 },
+  { "md5", 0, 1, 16 },
+  { "sha256", 0, 1, 32 },
+  { "aes-enc", aes::kKeyLength, aes::kBlockSize, 0 },
+  { "aes-dec", aes::kKeyLength, aes::kBlockSize, 0 },
+  { "rc4-enc", 16, 1, 0 },
+  { "rc4-dec", 16, 1, 0 },
+  { "bf-enc", 16, blowfish::kBlockSize, 0 },
+  { "bf-dec", 16, blowfish::kBlockSize, 0 },
+  { "tf-enc", twofish::kKeyLength, twofish::kBlockSize, 0 },
+  { "tf-dec", twofish::kKeyLength, twofish::kBlockSize, 0 },
+  { "fff-enc", threefish::kKeyLength, threefish::kBlockSize, 0 },
+  { "fff-dec", threefish::kKeyLength, threefish::kBlockSize, 0 },
+};
+constexpr uint32_t kNumAlgos = sizeof(kAlgos) / sizeof(kAlgos[0]);
+constexpr uint32_t kMaxKeySize = 32;
+
+const char *const kStageNames[stats::kNumStages] = {
+  "wait", "spawn", "trap", "copy-in", "cipher", "copy-out", "response",
+};
+const char *const kCounterNames[stats::kNumCounters] = {
+  "spin-hits", "spin-misses", "spin-blocking", "spin-budget(ns)", "copy-bulk", "copy-ptrace",
+  "in-place", "arena-allocs", "arena-system", "arena-returned",
+  "compute-tasks", "compute-occupancy", "compute-max", "copy-out-tasks", "copy-out-occupancy",
+  "copy-out-max", "respond-tasks", "respond-occupancy", "respond-max", "pool-steals",
+};
+
+// One algo:size[:weight] element of --mix, or the commands of a capture with the same algorithm and
+// input size.
+struct Entry {
+  uint32_t algo;
+  uint32_t size;
+  uint32_t weight;
+  // the answer of the first request, all others must match it
+  bool answered;
+  uint32_t retval;
+  uint64_t digest;
+  uint64_t errors;
+  uint64_t mismatches;
+  std::vector<uint64_t> latencies;
+  // as captured, for --replay
+  std::vector<uint64_t> captured;
+  // of the --against build
+  std::vector<uint64_t> baseline;
+};
+
+// What one request is made of.
+struct Job {
+  uint32_t entry;
+  uint32_t key_size, out_size;
+  bool in_place;
+  // the key is in the device key slot of the entry's index rather than sent along, --key-slots
+  bool key_slot;
+  // copied in as the input, a pattern of the entry if nullptr
+  const uint8_t *input;
+  // the answer to expect, otherwise that of the first request of the entry
+  bool expected;
+  uint32_t retval;
+  // of the capture, relative to its first command
+  uint64_t time;
+};
+
+// A request in flight. Each one has its own buffers: the firmware chains CBC blocks in the input
+// and the sandbox may convert keys in place, so neither can be shared.
+struct Slot {
+  uint32_t entry;
+  bool expected;
+  uint32_t retval;
+  // latencies are counted from then
+  uint64_t due;
+  uint32_t input, key, output;
+};
+
+struct Options {
+  const char *sandbox = "./sandbox";
+  const char *firmware = "firmware/firmware.bin.signed";
+  const char *replay = nullptr;
+  // another sandbox build the replay is compared with
+  const char *against = nullptr;
+  double speed = 1;
+  uint64_t requests = 10000;
+  // 0 for as many as fit
+  uint32_t depth = 0;
+  uint32_t seed = 1;
+  // in microseconds, 0 for no limit
+  uint64_t max_p99 = 0;
+  bool show_stats = false;
+  bool key_slots = false;
+  std::vector<Entry> mix;
+  std::vector<char *> sandbox_args;
+};
+
+Options options;
+volatile Csrs *csr;
+uint8_t *dram;
+int to_device, from_device;
+int stats_fd;
+pid_t sandbox_pid;
+
+[[noreturn]] void Fail(const char *msg) {
+  fprintf(stderr, "bench: %s\n", msg);
+  if (sandbox_pid > 0)
+    kill(sandbox_pid, SIGKILL);
+  exit(1);
+}
+
+[[noreturn]] void Usage() {
+  fprintf(stderr,
+          "usage: bench [options] [-- sandbox options]\n"
+          "  --sandbox=PATH       sandbox binary (./sandbox)\n"
+          "  --firmware=PATH      signed firmware image (firmware/firmware.bin.signed)\n"
+          "  --mix=ALGO:SIZE[:WEIGHT],...\n"
+          "                       requests to send, picked at random by weight (md5:4096)\n"
+          "  --requests=N         requests to time, after one warm-up round (10000)\n"
+          "  --depth=N            requests kept in flight, up to %u (1, or all that fit\n"
+          "                       when replaying)\n"
+          "  --seed=N             seed of the request order (1)\n"
+          "  --replay=PATH        send the commands of a capture of the sandbox instead of\n"
+          "                       the mix, and compare their latencies with the captured ones\n"
+          "  --speed=X            replay X times faster, 0 for back to back (1)\n"
+          "  --against=PATH       replay with this sandbox binary too, and compare with it\n"
+          "  --max-p99=US         fail if a 99th percentile latency is higher\n"
+          "  --stats              also print the sandbox's own per-stage histograms\n"
+          "  --key-slots          load the key of each entry of the mix into a device key\n"
+          "                       slot once, and have its requests refer to it\n"
+          "algorithms:",
+          kQueueSize);
+  for (const Algo &algo : kAlgos)
+    fprintf(stderr, " %s", algo.name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+uint64_t Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool ParseEntry(const char *str, Entry &entry) {
+  char name[16];
+  unsigned size, weight = 1;
+  int n = sscanf(str, "%15[^:]:%u:%u", name, &size, &weight);
+  if (n < 2 || weight == 0)
+    return false;
+  entry = Entry{};
+  entry.size = size;
+  entry.weight = weight;
+  for (entry.algo = 0; entry.algo < kNumAlgos; entry.algo++)
+    if (!strcmp(kAlgos[entry.algo].name, name))
+      break;
+  if (entry.algo == kNumAlgos) {
+    fprintf(stderr, "bench: unknown algorithm %s\n", name);
+    return false;
+  }
+  if (size == 0 || size % kAlgos[entry.algo].block_size) {
+    fprintf(stderr, "bench: %s needs a non-zero size in multiples of %u\n", name,
+            kAlgos[entry.algo].block_size);
+    return false;
+  }
+  return true;
+}
+
+bool ParseMix(char *list) {
+  for (char *item = strtok(list, ","); item; item = strtok(nullptr, ",")) {
+    Entry entry;
+    if (!ParseEntry(item, entry))
+      return false;
+    options.mix.push_back(std::move(entry));
+  }
+  return !options.mix.empty();
+}
+
+void ParseOptions(int argc, char *argv[]) {
+  static const struct option long_options[] = {
+    { "sandbox", required_argument, nullptr, 's' },
+    { "firmware", required_argument, nullptr, 'f' },
+    { "mix", required_argument, nullptr, 'm' },
+    { "requests", required_argument, nullptr, 'n' },
+    { "depth", required_argument, nullptr, 'd' },
+    { "seed", required_argument, nullptr, 'r' },
+    { "max-p99", required_argument, nullptr, 'p' },
+    { "stats", no_argument, nullptr, 'S' },
+    { "key-slots", no_argument, nullptr, 'k' },
+    { "replay", required_argument, nullptr, 'R' },
+    { "speed", required_argument, nullptr, 'x' },
+    { "against", required_argument, nullptr, 'a' },
+    { nullptr, 0, nullptr, 0 },
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "s:f:m:n:d:r:p:SkR:x:a:", long_options, nullptr)) != -1) {
+    switch (c) {
+    case 's':
+      options.sandbox = optarg;
+      break;
+    case 'f':
+      options.firmware = optarg;
+      break;
+    case 'm':
+      options.mix.clear();
+      if (!ParseMix(optarg))
+        Usage();
+      break;
+    case 'n':
+      options.requests = strtoull(optarg, nullptr, 0);
+      break;
+    case 'd':
+      options.depth = atoi(optarg);
+      if (options.depth < 1 || options.depth > kQueueSize)
+        Usage();
+      break;
+    case 'r':
+      options.seed = strtoul(optarg, nullptr, 0);
+      break;
+    case 'p':
+      options.max_p99 = strtoull(optarg, nullptr, 0);
+      break;
+    case 'S':
+      options.show_stats = true;
+      break;
+    case 'k':
+      options.key_slots = true;
+      break;
+    case 'R':
+      options.replay = optarg;
+      break;
+    case 'a':
+      options.against = optarg;
+      break;
+    case 'x':
+      options.speed = strtod(optarg, nullptr);
+      if (!(options.speed >= 0))
+        Usage();
+      break;
+    default:
+      Usage();
+    }
+  }
+  if (options.against && !options.replay)
+    Usage();
+  if (options.replay) {
+    options.mix.clear();
+  } else if (options.mix.empty()) {
+    char md5[] = "md5:4096";
+    ParseMix(md5);
+  }
+  // what follows "--" goes to the sandbox, argv[0] included
+  options.sandbox_args.push_back(const_cast<char *>("sandbox"));
+  for (int i = optind; i < argc; i++)
+    options.sandbox_args.push_back(argv[i]);
+  options.sandbox_args.push_back(nullptr);
+}
+
+// Creates the shared memory of the device, like QEMU's share_mem_init().
+int MemFd(const char *name, size_t size) {
+  int fd = memfd_create(name, MFD_CLOEXEC);
+  CHECK(fd >= 0);
+  CHECK(ftruncate(fd, size) == 0);
+  return fd;
+}
+
+void *Map(int fd, size_t size) {
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  CHECK(addr != MAP_FAILED);
+  return addr;
+}
+
+int MoveUp(int fd) {
+  int moved = fcntl(fd, F_DUPFD_CLOEXEC, kFirstFd);
+  CHECK(moved >= 0);
+  close(fd);
+  return moved;
+}
+
+void Trigger(int fd) {
+  uint64_t one = 1;
+  CHECK(write(fd, &one, sizeof(one)) == sizeof(one));
+}
+
+// Waits for the sandbox to signal, returning the eventfd counter, or 0 once @timeout_ns passed.
+// Without a timeout a sandbox silent for too long is a failure.
+uint64_t WaitEvent(int64_t timeout_ns = -1) {
+  struct pollfd pfd = { from_device, POLLIN, 0 };
+  int64_t ns = timeout_ns >= 0 ? timeout_ns : kTimeoutMs * 1000000ll;
+  struct timespec ts = { static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000) };
+  int ret = ppoll(&pfd, 1, &ts, nullptr);
+  if (ret == 0 && timeout_ns >= 0)
+    return 0;
+  if (ret == 0) {
+    int status;
+    if (waitpid(sandbox_pid, &status, WNOHANG) == sandbox_pid) {
+      sandbox_pid = 0;
+      fprintf(stderr, "bench: sandbox exited with status 0x%x\n", status);
+      Fail("sandbox died");
+    }
+    Fail("no answer from the sandbox");
+  }
+  CHECK(ret == 1);
+  uint64_t value;
+  CHECK(read(from_device, &value, sizeof(value)) == sizeof(value));
+  return value;
+}
+
+void Launch(const char *sandbox) {
+  int csr_fd = MoveUp(MemFd("chaos-csr", sizeof(Csrs)));
+  csr = static_cast<Csrs *>(Map(csr_fd, sizeof(Csrs)));
+  int dram_fd = MoveUp(MemFd("chaos-dram", kDramSize));
+  dram = static_cast<uint8_t *>(Map(dram_fd, kDramSize));
+  stats_fd = MoveUp(MemFd("chaos-stats", stats::kSize));
+  to_device = MoveUp(eventfd(0, EFD_CLOEXEC));
+  from_device = MoveUp(eventfd(0, EFD_CLOEXEC));
+
+  sandbox_pid = fork();
+  CHECK(sandbox_pid >= 0);
+  if (!sandbox_pid) {
+    // as launch_sandbox() of QEMU, stderr kept for DEBUG builds
+    close(0);
+    close(1);
+    dup2(csr_fd, kCsrFd);
+    dup2(dram_fd, kDramFd);
+    dup2(to_device, kEventFdToDevice);
+    dup2(from_device, kEventFdFromDevice);
+    dup2(stats_fd, stats::kFd);
+    execv(sandbox, options.sandbox_args.data());
+    _exit(127);
+  }
+  close(csr_fd);
+  close(dram_fd);
+}
+
+// Loads and boots the firmware as chaos_boot_firmware() of the driver does, the sandbox checking
+// its signature.
+void Boot() {
+  FILE *file = fopen(options.firmware, "rb");
+  if (!file)
+    Fail("can't open the firmware");
+  size_t size = fread(dram, 1, kCmdqAddr, file);
+  bool too_big = fgetc(file) != EOF;
+  fclose(file);
+  if (too_big)
+    Fail("firmware too big");
+  csr->fw_size = size;
+  csr->load_addr = 0;
+  Trigger(to_device);
+  if (WaitEvent() < kVerifiedEvent)
+    Fail("unexpected event before boot");
+  uint64_t result = csr->load_addr;
+  if (!(result & (1ull << 63)))
+    Fail("bootloader unresponsive");
+  if (int res = static_cast<int>(result ^ (1ull << 63))) {
+    fprintf(stderr, "bench: firmware rejected: %d\n", res);
+    Fail("boot failed");
+  }
+  memset(dram, 0, size);
+  csr->cmdq_addr = kCmdqAddr;
+  csr->cmdq_size = kQueueSize;
+  csr->rspq_addr = kRspqAddr;
+  csr->rspq_size = kQueueSize;
+}
+
+// DRAM a job needs besides its key.
+uint64_t BufferSize(const Job &job) {
+  uint64_t in = options.mix[job.entry].size;
+  return job.in_place ? std::max<uint64_t>(in, job.out_size) : in + job.out_size;
+}
+
+// Reads the capture at @path into @jobs and the entries of options.mix. Commands never answered
+// are left out, they may have crashed the firmware. @file keeps the captured inputs.
+void LoadCapture(const char *path, std::vector<uint8_t> &file, std::vector<Job> &jobs) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    Fail("can't open the capture");
+  uint8_t buf[0x10000];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    file.insert(file.end(), buf, buf + n);
+  fclose(f);
+  capture::FileHeader header;
+  if (file.size() < sizeof(header))
+    Fail("not a capture");
+  memcpy(&header, file.data(), sizeof(header));
+  if (header.magic != capture::kMagic || header.version != capture::kVersion)
+    Fail("not a capture of this version");
+
+  struct Captured {
+    Job job;
+    uint64_t answered_at;
+  };
+  std::vector<Captured> commands;
+  // latest command of each sequence number not answered yet, as an index in @commands plus one
+  std::vector<uint64_t> pending(1 << 16);
+  size_t off = sizeof(header);
+  while (off < file.size()) {
+    if (file[off] == capture::kCommand && file.size() - off >= sizeof(capture::Command)) {
+      capture::Command command;
+      memcpy(&command, &file[off], sizeof(command));
+      off += sizeof(command);
+      if (command.input_size > file.size() - off)
+        break;
+      Job job = {};
+      job.key_size = command.key_size;
+      job.out_size = command.out_size;
+      job.in_place = command.flags & capture::kInPlace;
+      job.input = command.input_size == command.in_size ? &file[off] : nullptr;
+      job.time = command.time;
+      off += command.input_size;
+      for (job.entry = 0; job.entry < options.mix.size(); job.entry++)
+        if (options.mix[job.entry].algo == command.algo &&
+            options.mix[job.entry].size == command.in_size)
+          break;
+      if (job.entry == options.mix.size()) {
+        Entry entry = {};
+        entry.algo = command.algo;
+        entry.size = command.in_size;
+        options.mix.push_back(std::move(entry));
+      }
+      commands.push_back(Captured{ job, 0 });
+      pending[command.seq] = commands.size();
+    } else if (file[off] == capture::kResponse &&
+               file.size() - off >= sizeof(capture::Response)) {
+      capture::Response response;
+      memcpy(&response, &file[off], sizeof(response));
+      off += sizeof(response);
+      if (uint64_t i = pending[response.seq]) {
+        Captured &c = commands[i - 1];
+        c.job.expected = true;
+        c.job.retval = response.retval;
+        c.answered_at = response.time;
+        pending[response.seq] = 0;
+      }
+    } else {
+      // cut short, or garbage from there on
+      break;
+    }
+  }
+  if (off != file.size())
+    fprintf(stderr, "bench: ignoring %zu bytes at the end of the capture\n", file.size() - off);
+
+  uint64_t unanswered = 0, too_big = 0;
+  for (const Captured &c : commands) {
+    if (!c.job.expected) {
+      unanswered++;
+    } else if (c.job.key_size + BufferSize(c.job) > kDramSize - kSlotAddr) {
+      too_big++;
+    } else {
+      jobs.push_back(c.job);
+      options.mix[c.job.entry].captured.push_back(c.answered_at - c.job.time);
+    }
+  }
+  if (unanswered)
+    fprintf(stderr, "bench: skipping %lu commands the capture has no answer to\n", unanswered);
+  if (too_big)
+    fprintf(stderr, "bench: skipping %lu commands too big to replay\n", too_big);
+  if (jobs.empty())
+    Fail("nothing to replay");
+  uint64_t first = jobs.front().time;
+  for (Job &job : jobs)
+    job.time -= first;
+}
+
+Job MixJob(uint32_t index) {
+  const Entry &entry = options.mix[index];
+  const Algo &algo = kAlgos[entry.algo];
+  Job job = {};
+  job.entry = index;
+  job.key_size = algo.key_size;
+  job.out_size = std::max(entry.size, algo.digest_size);
+  job.key_slot = options.key_slots && job.key_size;
+  return job;
+}
+
+// Gives each slot room for the biggest of @jobs. Returns false if not even one fits.
+bool PlaceSlots(const std::vector<Job> &jobs, std::vector<Slot> &slots) {
+  uint64_t max_key = 0, max_buffer = 0;
+  for (const Job &job : jobs) {
+    max_key = std::max<uint64_t>(max_key, job.key_size);
+    max_buffer = std::max(max_buffer, BufferSize(job));
+  }
+  uint64_t slot_size = (max_key + max_buffer + 7) & ~7ull;
+  uint64_t fit = (kDramSize - kSlotAddr) / std::max<uint64_t>(slot_size, 1);
+  uint64_t count = options.depth ? options.depth : std::min<uint64_t>(fit, kQueueSize);
+  if (count == 0 || count > fit)
+    return false;
+  slots.resize(count);
+  for (uint32_t i = 0; i < count; i++) {
+    slots[i].key = kSlotAddr + slot_size * i;
+    slots[i].input = slots[i].key + max_key;
+  }
+  return true;
+}
+
+void FillKey(uint32_t addr, const Job &job) {
+  for (uint32_t i = 0; i < job.key_size; i++)
+    dram[addr + i] = i * 3 + job.entry;
+}
+
+// Same input and key for every request of an entry, so that all answers are the same.
+void Fill(const Slot &slot, const Job &job) {
+  const Entry &entry = options.mix[job.entry];
+  if (job.input) {
+    memcpy(dram + slot.input, job.input, entry.size);
+  } else {
+    for (uint32_t i = 0; i < entry.size; i++)
+      dram[slot.input + i] = i * 2 + job.entry;
+  }
+  if (!job.key_slot)
+    FillKey(slot.key, job);
+}
+
+uint64_t Digest(const uint8_t *data, uint32_t size) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (uint32_t i = 0; i < size; i++)
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  return hash;
+}
+
+class Driver {
+ public:
+  explicit Driver(std::vector<Slot> &slots)
+      : slots_(slots), seq_(0), cmd_tail_(csr->cmd_tail), rsp_head_(csr->rsp_head),
+        rand_(options.seed), sent_(false) {
+    for (const Entry &entry : options.mix)
+      total_weight_ += entry.weight;
+    for (uint32_t i = slots_.size(); i > 0; i--)
+      free_.push_back(i - 1);
+  }
+
+  // Loads the key of each entry of the mix taking one into the key slot of the same index, waiting
+  // for each load. Done before any request is in flight.
+  void LoadKeys() {
+    for (uint32_t i = 0; i < options.mix.size(); i++) {
+      Job job = MixJob(i);
+      if (!job.key_slot)
+        continue;
+      if (i >= csr->key_slots)
+        Fail("more entries than key slots");
+      FillKey(slots_[0].key, job);
+      *reinterpret_cast<MailboxKey *>(dram + kRequestAddr) =
+          MailboxKey{ i, slots_[0].key, job.key_size };
+      Push(MailboxCmd{ seq_, 0, kCmdCodeKeyLoad, kRequestAddr, sizeof(MailboxKey) });
+      Publish();
+      while (!Answered())
+        WaitEvent();
+      const MailboxRsp *rspq = reinterpret_cast<const MailboxRsp *>(dram + kRspqAddr);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      uint32_t retval = rspq[rsp_head_ % kQueueSize].retval;
+      rsp_head_ = Next(rsp_head_);
+      csr->rsp_head = rsp_head_;
+      if (retval != 0)
+        Fail("key slot load failed");
+    }
+  }
+
+  // Sends @count requests of the mix, picked by weight or else each entry in turn, and waits for
+  // all of them.
+  void Run(uint64_t count, bool weighted, bool record) {
+    uint64_t sent = 0;
+    while (sent < count || InFlight()) {
+      while (sent < count && !free_.empty()) {
+        Send(MixJob(weighted ? Pick() : sent % options.mix.size()), Now());
+        sent++;
+      }
+      Publish();
+      // answers may be published before the signal comes, don't wait for one needlessly
+      while (!Answered())
+        WaitEvent();
+      Reap(record);
+    }
+  }
+
+  // Sends @jobs at the times they were captured, options.speed times faster, or back to back if it
+  // is 0. Latencies are counted from when a job was due: a late one was held back by the ones
+  // before.
+  void Replay(const std::vector<Job> &jobs) {
+    uint64_t start = Now();
+    size_t next = 0;
+    while (next < jobs.size() || InFlight()) {
+      uint64_t now = Now(), due = 0;
+      while (next < jobs.size() && !free_.empty()) {
+        if (!options.speed) {
+          Send(jobs[next++], now);
+          continue;
+        }
+        due = start + jobs[next].time / options.speed;
+        if (due > now)
+          break;
+        Send(jobs[next++], due);
+      }
+      Publish();
+      if (Answered()) {
+        Reap(true);
+      } else if (next < jobs.size() && !free_.empty()) {
+        // the next job is due later
+        if (InFlight())
+          WaitEvent(due - now);
+        else
+          SleepUntil(due);
+      } else {
+        WaitEvent();
+      }
+    }
+  }
+
+ private:
+  static uint64_t Next(uint64_t index) { return (index + 1) & (2 * kQueueSize - 1); }
+
+  static void SleepUntil(uint64_t ns) {
+    struct timespec ts = { static_cast<time_t>(ns / 1000000000),
+                           static_cast<long>(ns % 1000000000) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+  }
+
+  bool InFlight() const { return free_.size() < slots_.size(); }
+
+  bool Answered() const { return csr->rsp_tail != rsp_head_; }
+
+  uint32_t Pick() {
+    // xorshift32
+    rand_ ^= rand_ << 13;
+    rand_ ^= rand_ >> 17;
+    rand_ ^= rand_ << 5;
+    uint32_t r = rand_ % total_weight_;
+    for (uint32_t i = 0;; i++) {
+      if (r < options.mix[i].weight)
+        return i;
+      r -= options.mix[i].weight;
+    }
+  }
+
+  // Queues @job in a free slot, the doorbell is left to Publish().
+  void Send(const Job &job, uint64_t due) {
+    uint32_t index = free_.back();
+    free_.pop_back();
+    Slot &slot = slots_[index];
+    const Entry &entry = options.mix[job.entry];
+    slot.entry = job.entry;
+    slot.expected = job.expected;
+    slot.retval = job.retval;
+    slot.output = job.in_place ? slot.input : slot.input + entry.size;
+    Fill(slot, job);
+    Request *req = reinterpret_cast<Request *>(dram + kRequestAddr) + index;
+    *req = Request{
+      entry.algo | (job.key_slot ? kRequestKeySlot : 0),
+      slot.input, entry.size,
+      job.key_slot ? job.entry : slot.key, job.key_size,
+      slot.output, job.out_size,
+    };
+    // the slot is found again from the sequence number of the answer
+    seq_ = (seq_ & ~(kQueueSize - 1)) + kQueueSize + index;
+    Push(MailboxCmd{
+      seq_, 0, kCmdCodeRequest,
+      static_cast<uint32_t>(kRequestAddr + index * sizeof(Request)), sizeof(Request),
+    });
+    slot.due = due;
+  }
+
+  // Queues @cmd, the doorbell is left to Publish().
+  void Push(const MailboxCmd &cmd) {
+    MailboxCmd *cmdq = reinterpret_cast<MailboxCmd *>(dram + kCmdqAddr);
+    cmdq[cmd_tail_ % kQueueSize] = cmd;
+    cmd_tail_ = Next(cmd_tail_);
+    sent_ = true;
+  }
+
+  void Publish() {
+    if (!sent_)
+      return;
+    sent_ = false;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    csr->cmd_tail = cmd_tail_;
+    Trigger(to_device);
+  }
+
+  // Takes the answers published so far.
+  void Reap(bool record) {
+    uint64_t rsp_tail = csr->rsp_tail;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = Now();
+    const MailboxRsp *rspq = reinterpret_cast<const MailboxRsp *>(dram + kRspqAddr);
+    while (rsp_head_ != rsp_tail) {
+      MailboxRsp rsp = rspq[rsp_head_ % kQueueSize];
+      rsp_head_ = Next(rsp_head_);
+      uint32_t index = rsp.seq % kQueueSize;
+      Answer(slots_[index], rsp.retval, now, record);
+      free_.push_back(index);
+    }
+    csr->rsp_head = rsp_head_;
+  }
+
+  void Answer(const Slot &slot, uint32_t retval, uint64_t now, bool record) {
+    Entry &entry = options.mix[slot.entry];
+    if (slot.expected) {
+      if (retval != slot.retval)
+        entry.mismatches++;
+    } else if (entry.algo >= kNumAlgos || static_cast<int32_t>(retval) < 0 ||
+               retval > std::max(entry.size, kAlgos[entry.algo].digest_size)) {
+      entry.errors++;
+      return;
+    } else {
+      uint64_t digest = Digest(dram + slot.output, retval);
+      if (!entry.answered) {
+        entry.answered = true;
+        entry.retval = retval;
+        entry.digest = digest;
+      } else if (entry.retval != retval || entry.digest != digest) {
+        entry.mismatches++;
+      }
+    }
+    if (record)
+      entry.latencies.push_back(now - slot.due);
+  }
+
+  std::vector<Slot> &slots_;
+  std::vector<uint32_t> free_;
+  uint16_t seq_;
+  uint64_t cmd_tail_, rsp_head_;
+  uint32_t rand_;
+  uint32_t total_weight_ = 0;
+  // whether commands were queued since the last doorbell
+  bool sent_;
+};
+
+double Percentile(const std::vector<uint64_t> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  size_t i = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+  return sorted[i] / 1000.0;
+}
+
+std::string Name(const Entry &entry) {
+  if (entry.algo < kNumAlgos)
+    return kAlgos[entry.algo].name;
+  return "algo" + std::to_string(entry.algo);
+}
+
+// Prints a line per entry, returns false if the run should fail.
+bool Report(uint64_t elapsed_ns) {
+  bool ok = true;
+  double seconds = elapsed_ns / 1e9;
+  uint64_t total = 0, bytes = 0;
+  printf("%-8s %8s %8s %7s %10s %9s %9s %9s %9s %9s", "algo", "size", "requests", "errors",
+         "req/s", "MB/s", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+  if (options.replay)
+    printf(" %9s %9s", "cap p50", "cap p99");
+  if (options.against)
+    printf(" %9s %9s %8s %8s", "was p50", "was p99", "p50 +%", "p99 +%");
+  printf("\n");
+  for (Entry &entry : options.mix) {
+    // only skipped commands
+    if (options.replay && entry.captured.empty())
+      continue;
+    std::vector<uint64_t> &lat = entry.latencies;
+    std::sort(lat.begin(), lat.end());
+    uint64_t errors = entry.errors + entry.mismatches;
+    double p50 = Percentile(lat, 0.5), p99 = Percentile(lat, 0.99);
+    std::string name = Name(entry);
+    printf("%-8s %8u %8zu %7lu %10.0f %9.2f %9.1f %9.1f %9.1f %9.1f", name.c_str(), entry.size,
+           lat.size(), errors, lat.size() / seconds, lat.size() * entry.size / seconds / 1e6, p50,
+           Percentile(lat, 0.9), p99, lat.empty() ? 0 : lat.back() / 1000.0);
+    if (options.replay) {
+      // as the sandbox saw them, from serving the doorbell to signaling the answer
+      std::vector<uint64_t> &cap = entry.captured;
+      std::sort(cap.begin(), cap.end());
+      printf(" %9.1f %9.1f", Percentile(cap, 0.5), Percentile(cap, 0.99));
+    }
+    if (options.against) {
+      std::vector<uint64_t> &was = entry.baseline;
+      std::sort(was.begin(), was.end());
+      double was_p50 = Percentile(was, 0.5), was_p99 = Percentile(was, 0.99);
+      printf(" %9.1f %9.1f %8.1f %8.1f", was_p50, was_p99,
+             was_p50 ? (p50 / was_p50 - 1) * 100 : 0, was_p99 ? (p99 / was_p99 - 1) * 100 : 0);
+    }
+    printf("\n");
+    total += lat.size();
+    bytes += lat.size() * entry.size;
+    if (entry.errors)
+      fprintf(stderr, "bench: %s:%u: %lu requests failed\n", name.c_str(), entry.size,
+              entry.errors);
+    if (entry.mismatches)
+      fprintf(stderr, "bench: %s:%u: %lu answers differ from %s\n", name.c_str(), entry.size,
+              entry.mismatches, options.replay ? "the captured ones" : "the first one");
+    if (errors)
+      ok = false;
+    if (options.max_p99 && p99 > options.max_p99) {
+      fprintf(stderr, "bench: %s:%u: p99 %.1fus over the limit of %luus\n", name.c_str(),
+              entry.size, p99, options.max_p99);
+      ok = false;
+    }
+  }
+  printf("%-8s %8s %8lu %7s %10.0f %9.2f\n", "total", "", total, "", total / seconds,
+         bytes / seconds / 1e6);
+  return ok;
+}
+
+// Upper bound of the bucket the @p quantile falls in, in microseconds.
+double HistogramPercentile(const stats::Histogram &hist, double p) {
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < stats::kNumBuckets; i++) {
+    seen += hist.buckets[i];
+    if (seen && seen >= p * hist.count)
+      return (2ull << i) / 1000.0;
+  }
+  return 0;
+}
+
+void ReportStats() {
+  void *addr = Map(stats_fd, stats::kSize);
+  const stats::Page *page = static_cast<const stats::Page *>(addr);
+  if (page->magic != stats::kMagic || page->version != stats::kVersion) {
+    fprintf(stderr, "bench: the sandbox published no stats\n");
+    return;
+  }
+  printf("\n%-8s %-9s %10s %9s %9s %9s\n", "algo", "stage", "count", "avg(us)", "p50<(us)",
+         "p99<(us)");
+  for (uint32_t a = 0; a < stats::kNumAlgos; a++) {
+    const char *name = a < kNumAlgos ? kAlgos[a].name : a == stats::kAlgoKey ? "key" : "-";
+    for (uint32_t s = 0; s < stats::kNumStages; s++) {
+      const stats::Histogram &hist = page->histograms[a][s];
+      if (!hist.count)
+        continue;
+      printf("%-8s %-9s %10lu %9.1f %9.1f %9.1f\n", name, kStageNames[s], hist.count,
+             hist.total_ns / 1000.0 / hist.count, HistogramPercentile(hist, 0.5),
+             HistogramPercentile(hist, 0.99));
+    }
+  }
+  printf("\n");
+  for (uint32_t c = 0; c < stats::kNumCounters; c++)
+    printf("%-19s %10lu\n", kCounterNames[c], page->counters[c]);
+  munmap(addr, stats::kSize);
+}
+
+// Runs @sandbox through the mix or the replay, returns how long it took.
+uint64_t RunOnce(const char *sandbox, const std::vector<Job> &jobs, std::vector<Slot> &slots) {
+  Launch(sandbox);
+  Boot();
+  Driver driver(slots);
+  // replayed requests carry their keys
+  if (options.key_slots && !options.replay)
+    driver.LoadKeys();
+  uint64_t start = Now();
+  if (options.replay) {
+    driver.Replay(jobs);
+  } else {
+    // one request per entry first: spawns the firmware and records the reference answers
+    driver.Run(options.mix.size(), false, false);
+    start = Now();
+    driver.Run(options.requests, true, true);
+  }
+  uint64_t elapsed = Now() - start;
+  kill(sandbox_pid, SIGKILL);
+  waitpid(sandbox_pid, nullptr, 0);
+  sandbox_pid = 0;
+  munmap(const_cast<Csrs *>(csr), sizeof(Csrs));
+  munmap(dram, kDramSize);
+  close(to_device);
+  close(from_device);
+  return elapsed;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  ParseOptions(argc, argv);
+  signal(SIGPIPE, SIG_IGN);
+  std::vector<uint8_t> capture_file;
+  std::vector<Job> jobs;
+  if (options.replay) {
+    LoadCapture(options.replay, capture_file, jobs);
+  } else {
+    for (uint32_t i = 0; i < options.mix.size(); i++)
+      jobs.push_back(MixJob(i));
+    if (!options.depth)
+      options.depth = 1;
+  }
+  std::vector<Slot> slots;
+  if (!PlaceSlots(jobs, slots))
+    Fail("requests too big, or too many in flight, for DRAM");
+  if (options.against) {
+    RunOnce(options.against, jobs, slots);
+    close(stats_fd);
+    for (Entry &entry : options.mix)
+      entry.baseline.swap(entry.latencies);
+  }
+  uint64_t elapsed = RunOnce(options.sandbox, jobs, slots);
+  bool ok = Report(elapsed);
+  if (options.show_stats)
+    ReportStats();
+  return ok ? 0 : 1;
+}
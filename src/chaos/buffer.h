@@ -11,23 +11,50 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "arena.h"
 #include "check.h"
 #include "inferior.h"
 
+// Owns its storage, which comes from the arena and goes back to it when the buffer dies, unless
+// the buffer only borrows memory (see Borrow()). Move-only so a chunk has exactly one owner.
 class Buffer {
  public:
+  Buffer() : ptr_(nullptr), size_(0), owned_(false) {}
+
   Buffer(const uint8_t *from, uint32_t size) : Buffer(size) {
     if (Allocate())
       memcpy(ptr_, from, size_);
   }
 
-  Buffer(uint32_t size) : ptr_(nullptr), size_(size) {
+  Buffer(uint32_t size) : ptr_(nullptr), size_(size), owned_(true) {
     debug("size 0x%x\n", size_);
   }
+
+  Buffer(Buffer &&other) noexcept : ptr_(other.ptr_), size_(other.size_), owned_(other.owned_) {
+    other.ptr_ = nullptr;
+    other.size_ = 0;
+    other.owned_ = false;
+  }
+
+  Buffer &operator=(Buffer &&other) noexcept {
+    if (this != &other) {
+      Release();
+      ptr_ = other.ptr_;
+      size_ = other.size_;
+      owned_ = other.owned_;
+      other.ptr_ = nullptr;
+      other.size_ = 0;
+      other.owned_ = false;
+    }
+    return *this;
+  }
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
   ~Buffer() {
     debug("size 0x%x ptr %p\n", size_, ptr_);
-    if (ptr_)
-      delete ptr_;
+    Release();
   }
 
   bool FromUser(Inferior &inferior, uint32_t uptr) {
@@ -44,21 +71,23 @@ class Buffer {
   bool Allocate() {
     if (ptr_)
       return false;
-    if (size_ == 0 || size_ > 0x100000)
+    if (size_ == 0 || size_ > arena::kMaxChunk)
       return false;
-    ptr_ = new uint8_t[size_];
+    ptr_ = arena::Allocate(size_);
     if (!ptr_)
       return false;
     return true;
   }
 
-  bool ValueEq(const Buffer &other) const {
-    if (size_ < other.size()) return other.ValueEq(*this);
-    if (memcmp(ptr_, other.ptr(), other.size()))
+  // Makes this buffer a non-owning view of @ptr, which must stay valid while this buffer lives.
+  // Subject to the same size limits as Allocate().
+  bool Borrow(uint8_t *ptr) {
+    if (ptr_)
       return false;
-    for (uint32_t i = other.size(); i < size_; i++)
-      if (ptr_[i])
-        return false;
+    if (size_ == 0 || size_ > arena::kMaxChunk)
+      return false;
+    ptr_ = ptr;
+    owned_ = false;
     return true;
   }
 
@@ -73,10 +102,43 @@ class Buffer {
 
   inline uint8_t *ptr() const { return ptr_; }
   inline uint32_t size() const { return size_; }
+  inline bool owned() const { return owned_; }
 
  private:
+  void Release() {
+    if (ptr_ && owned_)
+      arena::Release(ptr_, size_);
+    ptr_ = nullptr;
+  }
+
   uint8_t *ptr_;
   uint32_t size_;
+  bool owned_;
+};
+
+// Read-only, non-owning view of memory owned by a Buffer, DRAM, or anything else that outlives it.
+class BufferView {
+ public:
+  BufferView() : ptr_(nullptr), size_(0) {}
+  BufferView(const uint8_t *ptr, uint32_t size) : ptr_(ptr), size_(size) {}
+  BufferView(const Buffer &buf) : ptr_(buf.ptr()), size_(buf.size()) {}
+
+  bool ValueEq(BufferView other) const {
+    if (size_ < other.size()) return other.ValueEq(*this);
+    if (memcmp(ptr_, other.ptr(), other.size()))
+      return false;
+    for (uint32_t i = other.size(); i < size_; i++)
+      if (ptr_[i])
+        return false;
+    return true;
+  }
+
+  inline const uint8_t *ptr() const { return ptr_; }
+  inline uint32_t size() const { return size_; }
+
+ private:
+  const uint8_t *ptr_;
+  uint32_t size_;
 };
 
 #endif // _BUFFER_H
@@ -0,0 +1,77 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#include "capture.h"
+
+#include <fcntl.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "check.h"
+#include "stats.h"
+
+namespace capture {
+
+namespace {
+
+int fd = -1;
+bool with_inputs;
+uint64_t start;
+std::vector<uint8_t> pending;
+
+void Append(const void *data, uint32_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  pending.insert(pending.end(), bytes, bytes + size);
+}
+
+}
+
+void Open(const char *path, bool inputs) {
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  CHECK(fd >= 0);
+  with_inputs = inputs;
+  start = stats::Now();
+  FileHeader header = { kMagic, kVersion, inputs ? kFlagInputs : 0, 0 };
+  Append(&header, sizeof(header));
+  Flush();
+}
+
+bool enabled() {
+  return fd >= 0;
+}
+
+bool inputs() {
+  return with_inputs;
+}
+
+void AddCommand(const Command &command, const uint8_t *input) {
+  Append(&command, sizeof(command));
+  if (command.input_size)
+    Append(input, command.input_size);
+}
+
+void AddResponse(uint16_t seq, uint32_t retval) {
+  Response response = { kResponse, 0, seq, retval, Now() };
+  Append(&response, sizeof(response));
+}
+
+uint64_t Now() {
+  return stats::Now() - start;
+}
+
+void Flush() {
+  if (pending.empty())
+    return;
+  if (fd >= 0 && write(fd, pending.data(), pending.size()) != (ssize_t)pending.size()) {
+    debug("capture stopped, writing %zu bytes failed\n", pending.size());
+    close(fd);
+    fd = -1;
+  }
+  pending.clear();
+}
+
+}
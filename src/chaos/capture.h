@@ -0,0 +1,89 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <cstdint>
+
+// Recording of the commands the sandbox is sent and of its answers, for bench --replay to play
+// them again. Off unless --capture is given. Commands are read from the queue when the sandbox
+// serves a doorbell or signals answers, and stamped with that time: a host reusing the memory of
+// a request answered but not signaled yet may get the new contents recorded.
+namespace capture {
+
+// A capture file is a FileHeader and then records, each starting with its RecordType. Times are
+// in nanoseconds since the capture started.
+constexpr uint32_t kMagic = 0x50414343; // "CCAP"
+constexpr uint32_t kVersion = 1;
+
+// FileHeader flags.
+// Commands are followed by their input bytes, otherwise only the size of the input is kept.
+constexpr uint32_t kFlagInputs = 1;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+enum RecordType : uint8_t {
+  kCommand = 1,
+  kResponse = 2,
+};
+
+// Command flags.
+// The request has its output where its input is.
+constexpr uint8_t kInPlace = 1;
+// The request took its key from a slot, key_size is that of the key in the slot when captured.
+// Replays pass such a key inline.
+constexpr uint8_t kKeySlot = 2;
+
+// A command seen in the queue. Addresses are dropped, the key is only kept by its size.
+struct Command {
+  uint8_t type;
+  uint8_t flags;
+  uint16_t seq;
+  uint32_t algo;
+  uint64_t time;
+  uint32_t in_size;
+  uint32_t key_size;
+  uint32_t out_size;
+  // bytes of input following the record, in_size if inputs are captured and 0 if not
+  uint32_t input_size;
+};
+static_assert(sizeof(Command) == 32);
+
+// An answer published by the sandbox, to the latest command with the same sequence number.
+struct Response {
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t seq;
+  uint32_t retval;
+  uint64_t time;
+};
+static_assert(sizeof(Response) == 16);
+
+// Creates the file at @path, truncating it. Done before the seccomp filter is installed.
+void Open(const char *path, bool inputs);
+
+bool enabled();
+bool inputs();
+
+// Records are buffered until Flush().
+void AddCommand(const Command &command, const uint8_t *input);
+void AddResponse(uint16_t seq, uint32_t retval);
+
+// Nanoseconds since the capture started.
+uint64_t Now();
+
+// Writes out the buffered records. A failed write ends the capture rather than the sandbox.
+void Flush();
+
+}
+
+#endif // _CAPTURE_H
@@ -14,10 +14,31 @@ namespace aes {
 
 constexpr size_t kBlockSize = 16;
 constexpr size_t kKeyLength = 16;
+constexpr int kRounds = 10;
 
-void encrypt(uint8_t *key, uint8_t *inb, uint8_t *outb);
+// Round keys as little-endian column words, expanded by setkey() once
+// for any number of blocks. dk are the round keys of the equivalent
+// inverse cipher, in the order decrypt() uses them.
+struct Context {
+  uint32_t ek[4 * (kRounds + 1)];
+  uint32_t dk[4 * (kRounds + 1)];
+};
 
-void decrypt(uint8_t *key, uint8_t *inb, uint8_t *outb);
+void setkey(Context &ctx, const uint8_t *key);
+
+void encrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+// @n independent blocks, in place if @inb == @outb.
+void encrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+void decrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+// Single blocks, expanding @key for each.
+void encrypt(const uint8_t *key, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const uint8_t *key, const uint8_t *inb, uint8_t *outb);
 
 }
 
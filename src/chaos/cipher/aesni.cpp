@@ -0,0 +1,128 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 lyc
+ */
+
+#include "aesni.h"
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Compiled for the instructions without requiring them of the whole binary, which still runs on
+// CPUs lacking them as long as supported() is checked first.
+#define AESNI __attribute__((target("aes")))
+
+namespace {
+
+using aes::kBlockSize;
+using aes::kRounds;
+using aesni::kLanes;
+
+// aes::Context keeps its round keys as little-endian words, which are the round key bytes in
+// order on x86. Its decryption keys are those of the equivalent inverse cipher aesdec expects.
+AESNI inline void load_keys(const uint32_t *words, __m128i rk[kRounds + 1]) {
+  for (int r = 0; r <= kRounds; r++) {
+    rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + 4 * r));
+  }
+}
+
+AESNI inline __m128i load(const uint8_t *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+AESNI inline void store(__m128i b, uint8_t *p) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(p), b);
+}
+
+AESNI inline __m128i encrypt_block(const __m128i rk[kRounds + 1], __m128i b) {
+  b = _mm_xor_si128(b, rk[0]);
+  for (int r = 1; r < kRounds; r++) {
+    b = _mm_aesenc_si128(b, rk[r]);
+  }
+  return _mm_aesenclast_si128(b, rk[kRounds]);
+}
+
+AESNI inline __m128i decrypt_block(const __m128i rk[kRounds + 1], __m128i b) {
+  b = _mm_xor_si128(b, rk[0]);
+  for (int r = 1; r < kRounds; r++) {
+    b = _mm_aesdec_si128(b, rk[r]);
+  }
+  return _mm_aesdeclast_si128(b, rk[kRounds]);
+}
+
+} // namespace
+
+namespace aesni {
+
+bool supported() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+}
+
+AESNI void encrypt(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb) {
+  __m128i rk[kRounds + 1];
+  load_keys(ctx.ek, rk);
+  store(encrypt_block(rk, load(inb)), outb);
+}
+
+AESNI void decrypt(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb) {
+  __m128i rk[kRounds + 1];
+  load_keys(ctx.dk, rk);
+  store(decrypt_block(rk, load(inb)), outb);
+}
+
+AESNI void encrypt_blocks(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  __m128i rk[kRounds + 1];
+  load_keys(ctx.ek, rk);
+  for (; n >= kLanes; n -= kLanes, inb += kLanes * kBlockSize, outb += kLanes * kBlockSize) {
+    __m128i b[kLanes];
+#pragma GCC unroll 8
+    for (size_t i = 0; i < kLanes; i++) {
+      b[i] = _mm_xor_si128(load(inb + i * kBlockSize), rk[0]);
+    }
+    for (int r = 1; r < kRounds; r++) {
+#pragma GCC unroll 8
+      for (size_t i = 0; i < kLanes; i++) {
+        b[i] = _mm_aesenc_si128(b[i], rk[r]);
+      }
+    }
+#pragma GCC unroll 8
+    for (size_t i = 0; i < kLanes; i++) {
+      store(_mm_aesenclast_si128(b[i], rk[kRounds]), outb + i * kBlockSize);
+    }
+  }
+  for (; n; n--, inb += kBlockSize, outb += kBlockSize) {
+    store(encrypt_block(rk, load(inb)), outb);
+  }
+}
+
+AESNI void decrypt_blocks(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  __m128i rk[kRounds + 1];
+  load_keys(ctx.dk, rk);
+  for (; n >= kLanes; n -= kLanes, inb += kLanes * kBlockSize, outb += kLanes * kBlockSize) {
+    __m128i b[kLanes];
+#pragma GCC unroll 8
+    for (size_t i = 0; i < kLanes; i++) {
+      b[i] = _mm_xor_si128(load(inb + i * kBlockSize), rk[0]);
+    }
+    for (int r = 1; r < kRounds; r++) {
+#pragma GCC unroll 8
+      for (size_t i = 0; i < kLanes; i++) {
+        b[i] = _mm_aesdec_si128(b[i], rk[r]);
+      }
+    }
+#pragma GCC unroll 8
+    for (size_t i = 0; i < kLanes; i++) {
+      store(_mm_aesdeclast_si128(b[i], rk[kRounds]), outb + i * kBlockSize);
+    }
+  }
+  for (; n; n--, inb += kBlockSize, outb += kBlockSize) {
+    store(decrypt_block(rk, load(inb)), outb);
+  }
+}
+
+}
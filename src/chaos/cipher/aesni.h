@@ -0,0 +1,36 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 lyc
+ */
+
+#ifndef _AESNI_H
+#define _AESNI_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "aes.h"
+
+// AES with the AES-NI instructions, on the same aes::Context as the portable code. Only to be
+// called if supported() says the CPU has them.
+namespace aesni {
+
+// blocks encrypt_blocks() and decrypt_blocks() run at a time
+constexpr size_t kLanes = 8;
+
+bool supported();
+
+void encrypt(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+// @n independent blocks, in place if @inb == @outb. The rounds of kLanes blocks are interleaved
+// to hide the latency of aesenc / aesdec.
+void encrypt_blocks(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+void decrypt_blocks(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+}
+
+#endif // _AESNI_H
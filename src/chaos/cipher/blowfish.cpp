@@ -203,8 +203,7 @@ const uint32_t initial_sbox[4][256] = {
   }
 };
 
-uint32_t P[18];
-uint32_t S[4][256];
+using blowfish::Context;
 
 void convert_endian(uint8_t *arr, size_t size) {
   for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
@@ -212,53 +211,78 @@ void convert_endian(uint8_t *arr, size_t size) {
   }
 }
 
-void reset() {
-  memcpy(P, initial_pary, sizeof(initial_pary));
-  memcpy(S, initial_sbox, sizeof(initial_sbox));
+// Words as convert_endian() leaves them, without touching @p.
+inline uint32_t load_be(const uint8_t *p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return __builtin_bswap32(x);
 }
 
-uint32_t f(uint32_t x) {
+inline void store_be(uint32_t x, uint8_t *p) {
+  x = __builtin_bswap32(x);
+  memcpy(p, &x, sizeof(x));
+}
+
+inline uint32_t load(const uint8_t *p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+void reset(Context &ctx) {
+  memcpy(ctx.P, initial_pary, sizeof(initial_pary));
+  memcpy(ctx.S, initial_sbox, sizeof(initial_sbox));
+}
+
+uint32_t f(const Context &ctx, uint32_t x) {
+  const auto &S = ctx.S;
   uint32_t h = S[0][x >> 24] + S[1][x >> 16 & 0xff];
   return (h ^ S[2][x >> 8 & 0xff]) + S[3][x & 0xff];
 }
 
-void enc(uint32_t *L, uint32_t *R) {
+void enc(const Context &ctx, uint32_t *L, uint32_t *R) {
+  const auto &P = ctx.P;
   for (int i = 0 ; i < 16 ; i += 2) {
     *L ^= P[i];
-    *R ^= f(*L);
+    *R ^= f(ctx, *L);
     *R ^= P[i + 1];
-    *L ^= f(*R);
+    *L ^= f(ctx, *R);
   }
   *L ^= P[16];
   *R ^= P[17];
   std::swap(*L, *R);
 }
 
-void dec(uint32_t *L, uint32_t *R) {
+void dec(const Context &ctx, uint32_t *L, uint32_t *R) {
+  const auto &P = ctx.P;
   for (int i = 16; i > 0; i -= 2) {
     *L ^= P[i + 1];
-    *R ^= f(*L);
+    *R ^= f(ctx, *L);
     *R ^= P[i];
-    *L ^= f(*R);
+    *L ^= f(ctx, *R);
   }
   *L ^= P[1];
   *R ^= P[0];
   std::swap(*L, *R);
 }
 
-void setkey(uint32_t *key, size_t klen) {
-  reset();
+// @klen is in words.
+void expand(Context &ctx, const uint8_t *key, size_t klen, bool swap) {
+  auto &P = ctx.P;
+  auto &S = ctx.S;
+  reset(ctx);
   for (int i = 0 ; i < 18; ++i) {
-    P[i] ^= key[i % klen];
+    const uint8_t *word = key + (i % klen) * sizeof(uint32_t);
+    P[i] ^= swap ? load_be(word) : load(word);
   }
   uint32_t L = 0, R = 0;
   for (int i = 0 ; i < 18; i += 2) {
-    enc(&L, &R);
+    enc(ctx, &L, &R);
     P[i] = L; P[i + 1] = R;
   }
   for (int i = 0 ; i < 4; ++i) {
     for (int j = 0 ; j < 256; j += 2) {
-      enc(&L, &R);
+      enc(ctx, &L, &R);
       S[i][j] = L; S[i][j+1] = R;
     }
   }
@@ -268,22 +292,52 @@ void setkey(uint32_t *key, size_t klen) {
 
 namespace blowfish {
 
-void encrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb) {
-  memcpy(outb, inb, kBlockSize);
+void setkey(Context &ctx, const uint8_t *key, size_t klen, bool swap) {
+  expand(ctx, key, klen / sizeof(uint32_t), swap);
+}
+
+void encrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb) {
+  uint32_t L = load_be(inb), R = load_be(inb + sizeof(uint32_t));
+  enc(ctx, &L, &R);
+  store_be(L, outb);
+  store_be(R, outb + sizeof(uint32_t));
+}
+
+void decrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb) {
+  uint32_t L = load_be(inb), R = load_be(inb + sizeof(uint32_t));
+  dec(ctx, &L, &R);
+  store_be(L, outb);
+  store_be(R, outb + sizeof(uint32_t));
+}
+
+void encrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    encrypt(ctx, inb + i * kBlockSize, outb + i * kBlockSize);
+  }
+}
+
+void decrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    decrypt(ctx, inb + i * kBlockSize, outb + i * kBlockSize);
+  }
+}
+
+void encrypt(uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb) {
+  Context ctx;
+  convert_endian(key, klen);
+  setkey(ctx, key, klen, false);
+  encrypt(ctx, inb, outb);
+}
+
+void decrypt(uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb) {
+  Context ctx;
   convert_endian(key, klen);
-  convert_endian(outb, kBlockSize);
-  setkey((uint32_t *)key, klen / sizeof(uint32_t));
-  enc((uint32_t *)outb, ((uint32_t *)outb) + 1);
-  convert_endian(outb, kBlockSize);
+  setkey(ctx, key, klen, false);
+  decrypt(ctx, inb, outb);
 }
 
-void decrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb) {
-  memcpy(outb, inb, kBlockSize);
+void convert_key(uint8_t *key, size_t klen) {
   convert_endian(key, klen);
-  convert_endian(outb, kBlockSize);
-  setkey((uint32_t *)key, klen / sizeof(uint32_t));
-  dec((uint32_t *)outb, ((uint32_t *)outb) + 1);
-  convert_endian(outb, kBlockSize);
 }
 
 }
@@ -15,9 +15,32 @@ namespace blowfish {
 constexpr size_t kBlockSize = 8;
 constexpr size_t kMaxKeyLength = 56;
 
-void encrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb);
+// Key schedule, expanded by setkey() once for any number of blocks.
+struct Context {
+  uint32_t P[18];
+  uint32_t S[4][256];
+};
 
-void decrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb);
+// Expands @key as encrypt() and decrypt() see it once converted: native-endian words. If @swap,
+// expands it as if convert_key() was applied to it first, without touching it.
+void setkey(Context &ctx, const uint8_t *key, size_t klen, bool swap);
+
+void encrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+// @n independent blocks, in place if @inb == @outb.
+void encrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+void decrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+// Single blocks, converting @key in place and expanding it for each.
+void encrypt(uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb);
+
+// What encrypt() and decrypt() do to @key: swaps the byte order of each of its words.
+void convert_key(uint8_t *key, size_t klen);
 
 }
 #endif // _BLOWFISH_H
@@ -0,0 +1,118 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 lyc
+ */
+
+#include "blowfish_avx2.h"
+
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// See aesni.cpp, the binary still runs without AVX2 as long as supported() is checked first.
+#define AVX2 __attribute__((target("avx2")))
+
+namespace {
+
+using blowfish::Context;
+using blowfish::kBlockSize;
+using blowfish_avx2::kLanes;
+
+// Blocks are big-endian word pairs, the data is swapped on the way in and out.
+AVX2 inline __m256i bswap32(__m256i x) {
+  const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  return _mm256_shuffle_epi8(x, mask);
+}
+
+// Splits kLanes blocks at @p into their left and right halves, lane i holding block i.
+AVX2 inline void load(const uint8_t *p, __m256i &L, __m256i &R) {
+  const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+  a = _mm256_permutevar8x32_epi32(bswap32(a), split);
+  b = _mm256_permutevar8x32_epi32(bswap32(b), split);
+  L = _mm256_permute2x128_si256(a, b, 0x20);
+  R = _mm256_permute2x128_si256(a, b, 0x31);
+}
+
+AVX2 inline void store(__m256i L, __m256i R, uint8_t *p) {
+  const __m256i merge = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  __m256i a = _mm256_permute2x128_si256(L, R, 0x20);
+  __m256i b = _mm256_permute2x128_si256(L, R, 0x31);
+  a = bswap32(_mm256_permutevar8x32_epi32(a, merge));
+  b = bswap32(_mm256_permutevar8x32_epi32(b, merge));
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), a);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + 32), b);
+}
+
+AVX2 inline __m256i f(const Context &ctx, __m256i x) {
+  const __m256i byte = _mm256_set1_epi32(0xff);
+  const int *S0 = reinterpret_cast<const int *>(ctx.S[0]);
+  const int *S1 = reinterpret_cast<const int *>(ctx.S[1]);
+  const int *S2 = reinterpret_cast<const int *>(ctx.S[2]);
+  const int *S3 = reinterpret_cast<const int *>(ctx.S[3]);
+  __m256i a = _mm256_i32gather_epi32(S0, _mm256_srli_epi32(x, 24), 4);
+  __m256i b = _mm256_i32gather_epi32(S1, _mm256_and_si256(_mm256_srli_epi32(x, 16), byte), 4);
+  __m256i c = _mm256_i32gather_epi32(S2, _mm256_and_si256(_mm256_srli_epi32(x, 8), byte), 4);
+  __m256i d = _mm256_i32gather_epi32(S3, _mm256_and_si256(x, byte), 4);
+  return _mm256_add_epi32(_mm256_xor_si256(_mm256_add_epi32(a, b), c), d);
+}
+
+AVX2 inline __m256i p(const Context &ctx, int i) {
+  return _mm256_set1_epi32(ctx.P[i]);
+}
+
+// As enc() and dec() of blowfish.cpp, the final swap is left to the caller.
+AVX2 inline void enc(const Context &ctx, __m256i &L, __m256i &R) {
+  for (int i = 0; i < 16; i += 2) {
+    L = _mm256_xor_si256(L, p(ctx, i));
+    R = _mm256_xor_si256(R, _mm256_xor_si256(f(ctx, L), p(ctx, i + 1)));
+    L = _mm256_xor_si256(L, f(ctx, R));
+  }
+  L = _mm256_xor_si256(L, p(ctx, 16));
+  R = _mm256_xor_si256(R, p(ctx, 17));
+}
+
+AVX2 inline void dec(const Context &ctx, __m256i &L, __m256i &R) {
+  for (int i = 16; i > 0; i -= 2) {
+    L = _mm256_xor_si256(L, p(ctx, i + 1));
+    R = _mm256_xor_si256(R, _mm256_xor_si256(f(ctx, L), p(ctx, i)));
+    L = _mm256_xor_si256(L, f(ctx, R));
+  }
+  L = _mm256_xor_si256(L, p(ctx, 1));
+  R = _mm256_xor_si256(R, p(ctx, 0));
+}
+
+} // namespace
+
+namespace blowfish_avx2 {
+
+bool supported() {
+  // also checks that the OS saves the ymm registers
+  return __builtin_cpu_supports("avx2");
+}
+
+AVX2 void encrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (; n >= kLanes; n -= kLanes, inb += kLanes * kBlockSize, outb += kLanes * kBlockSize) {
+    __m256i L, R;
+    load(inb, L, R);
+    enc(ctx, L, R);
+    store(R, L, outb);
+  }
+  blowfish::encrypt_blocks(ctx, inb, outb, n);
+}
+
+AVX2 void decrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (; n >= kLanes; n -= kLanes, inb += kLanes * kBlockSize, outb += kLanes * kBlockSize) {
+    __m256i L, R;
+    load(inb, L, R);
+    dec(ctx, L, R);
+    store(R, L, outb);
+  }
+  blowfish::decrypt_blocks(ctx, inb, outb, n);
+}
+
+}
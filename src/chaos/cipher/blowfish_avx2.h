@@ -0,0 +1,30 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 lyc
+ */
+
+#ifndef _BLOWFISH_AVX2_H
+#define _BLOWFISH_AVX2_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "blowfish.h"
+
+// Blowfish on kLanes blocks at once with AVX2, a lane each, the S-box lookups done by gathers.
+// Only to be called if supported() says the CPU has AVX2.
+namespace blowfish_avx2 {
+
+constexpr size_t kLanes = 8;
+
+bool supported();
+
+// @n independent blocks, in place if @inb == @outb. Fewer than kLanes left are done one by one.
+void encrypt_blocks(const blowfish::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+void decrypt_blocks(const blowfish::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+}
+
+#endif // _BLOWFISH_AVX2_H
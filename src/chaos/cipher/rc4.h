@@ -12,7 +12,7 @@
 
 namespace rc4 {
 
-void encrypt(uint8_t *key, size_t klen, uint8_t *inb, size_t len, uint8_t *outb);
+void encrypt(const uint8_t *key, size_t klen, const uint8_t *inb, size_t len, uint8_t *outb);
 
 // RC4 decryption is identical to encryption.
 const auto decrypt = encrypt;
@@ -12,7 +12,7 @@
 
 namespace rsa {
 
-void encrypt(uint8_t *N, size_t nlen, uint8_t *E, size_t elen, uint8_t *inb, size_t len, uint8_t *outb);
+void encrypt(const uint8_t *N, size_t nlen, const uint8_t *E, size_t elen, const uint8_t *inb, size_t len, uint8_t *outb);
 
 // RSA decryption is identical to encryption.
 const auto decrypt = encrypt;
@@ -13,7 +13,8 @@
 
 namespace {
 
-uint64_t m_rkey[5];
+// threefish::Context::rkey, as the round functions take it
+using RoundKey = uint64_t[5];
 
 #define rotr(x,n) (((x) >> ((int)(n))) | ((x) << (64 - (int)(n))))
 #define rotl(x,n) (((x) << ((int)(n))) | ((x) >> (64 - (int)(n))))
@@ -46,13 +47,13 @@ inline void IG256(uint64_t& G0, uint64_t& G1, uint64_t& G2, uint64_t& G3) {
     G2 -= m_rkey[(r + 3) % 5]; \
     G3 -= m_rkey[(r + 4) % 5] + r + 1;
 
-void setkey(uint64_t *in_key) {
+void expand(const uint64_t *in_key, RoundKey m_rkey) {
   for (int i = 0; i < 4 ; i++)
     m_rkey[i] = in_key[i];
   m_rkey[4] = 0x1BD11BDAA9FC1A22 ^ m_rkey[0] ^ m_rkey[1] ^ m_rkey[2] ^ m_rkey[3];
 }
 
-void enc(uint64_t *data) {
+void enc(const RoundKey m_rkey, uint64_t *data) {
   uint64_t G0 = data[0] + m_rkey[0];
   uint64_t G1 = data[1] + m_rkey[1];
   uint64_t G2 = data[2] + m_rkey[2];
@@ -75,7 +76,7 @@ void enc(uint64_t *data) {
   data[3] = G3;
 }
 
-void dec(uint64_t *data) {
+void dec(const RoundKey m_rkey, uint64_t *data) {
   uint64_t G0 = data[0] - m_rkey[3];
   uint64_t G1 = data[1] - m_rkey[4];
   uint64_t G2 = data[2] - m_rkey[0];
@@ -104,16 +105,30 @@ void dec(uint64_t *data) {
 
 namespace threefish {
 
-void encrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb) {
+void setkey(Context &ctx, const uint8_t *key, size_t klen) {
+  expand((const uint64_t *)key, ctx.rkey);
+}
+
+void encrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb) {
   memcpy(outb, inb, kBlockSize);
-  setkey((uint64_t *)key);
-  enc((uint64_t *)outb);
+  enc(ctx.rkey, (uint64_t *)outb);
 }
 
-void decrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb) {
+void decrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb) {
   memcpy(outb, inb, kBlockSize);
-  setkey((uint64_t *)key);
-  dec((uint64_t *)outb);
+  dec(ctx.rkey, (uint64_t *)outb);
+}
+
+void encrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb) {
+  Context ctx;
+  setkey(ctx, key, klen);
+  encrypt(ctx, inb, outb);
+}
+
+void decrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb) {
+  Context ctx;
+  setkey(ctx, key, klen);
+  decrypt(ctx, inb, outb);
 }
 
 }
@@ -15,9 +15,21 @@ namespace threefish {
 constexpr size_t kBlockSize = 32;
 constexpr size_t kKeyLength = 32;
 
-void encrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb);
+// Key schedule: the key words followed by their parity word.
+struct Context {
+  uint64_t rkey[5];
+};
 
-void decrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb);
+void setkey(Context &ctx, const uint8_t *key, size_t klen);
+
+void encrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+// Single blocks, expanding @key for each.
+void encrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb);
 
 }
 #endif // _THREEFISH_H
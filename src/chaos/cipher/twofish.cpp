@@ -8,6 +8,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <array>
 #include <cstring>
 #include <utility>
 
@@ -45,41 +46,40 @@ constexpr uint8_t qt3[2][16] = {
     { 11, 9, 5, 1, 12, 3, 13, 14, 6, 4, 7, 15, 2, 0, 8, 10 }
 };
 
-uint8_t q_tab[2][256];
-
-uint32_t s_key[2];
-uint32_t l_key[40];
-uint32_t m_tab[4][256];
-uint32_t mk_tab[4][256];
-
-uint8_t qp(const uint32_t n, uint8_t x) {
-  uint8_t a0, a1, a2, a3, a4, b0, b1, b2, b3, b4;
-  a0 = x >> 4;
-  b0 = x & 15;
-  a1 = a0 ^ b0;
-  b1 = ror4[b0] ^ ashx[a0];
-  a2 = qt0[n][a1];
-  b2 = qt1[n][b1];
-  a3 = a2 ^ b2;
-  b3 = ror4[b2] ^ ashx[a2];
-  a4 = qt2[n][a3];
-  b4 = qt3[n][b3];
+using twofish::Context;
+
+constexpr uint8_t qp(const uint32_t n, uint8_t x) {
+  uint8_t a0 = x >> 4;
+  uint8_t b0 = x & 15;
+  uint8_t a1 = a0 ^ b0;
+  uint8_t b1 = ror4[b0] ^ ashx[a0];
+  uint8_t a2 = qt0[n][a1];
+  uint8_t b2 = qt1[n][b1];
+  uint8_t a3 = a2 ^ b2;
+  uint8_t b3 = ror4[b2] ^ ashx[a2];
+  uint8_t a4 = qt2[n][a3];
+  uint8_t b4 = qt3[n][b3];
   return (b4 << 4) | a4;
 }
 
-void gen_qtab() {
+constexpr std::array<std::array<uint8_t, 256>, 2> gen_qtab() {
+  std::array<std::array<uint8_t, 256>, 2> q_tab{};
   for (int i = 0; i < 256; ++i) {
     q_tab[0][i] = qp(0, i);
     q_tab[1][i] = qp(1, i);
   }
+  return q_tab;
 }
 
+// Key-independent, generated at compile time.
+constexpr auto q_tab = gen_qtab();
+
 #define q(n,x)  q_tab[n][x]
 
-void gen_mtab() {
-  uint32_t f01, f5b, fef;
+constexpr std::array<std::array<uint32_t, 256>, 4> gen_mtab() {
+  std::array<std::array<uint32_t, 256>, 4> m_tab{};
   for(int i = 0; i < 256; ++i) {
-    f01 = q(1,i); f5b = ffm_5b(f01); fef = ffm_ef(f01);
+    uint32_t f01 = q(1,i), f5b = ffm_5b(f01), fef = ffm_ef(f01);
     m_tab[0][i] = f01 + (f5b << 8) + (fef << 16) + (fef << 24);
     m_tab[2][i] = f5b + (fef << 8) + (f01 << 16) + (fef << 24);
 
@@ -87,8 +87,11 @@ void gen_mtab() {
     m_tab[1][i] = fef + (fef << 8) + (f5b << 16) + (f01 << 24);
     m_tab[3][i] = f5b + (f01 << 8) + (fef << 16) + (f5b << 24);
   }
+  return m_tab;
 }
 
+constexpr auto m_tab = gen_mtab();
+
 #define BYTE(x, n) ((x>>(8 * n)) & 0xff)
 
 uint32_t h(uint32_t x, const uint32_t key[]) {
@@ -108,7 +111,9 @@ uint32_t h(uint32_t x, const uint32_t key[]) {
 #define q22(x) (q(1, q(0, x) ^ BYTE(s_key[1], 2)) ^ BYTE(s_key[0], 2))
 #define q23(x) (q(1, q(1, x) ^ BYTE(s_key[1], 3)) ^ BYTE(s_key[0], 3))
 
-void gen_mk_tab() {
+void gen_mk_tab(Context &ctx) {
+  const auto &s_key = ctx.s_key;
+  auto &mk_tab = ctx.mk_tab;
   for (int i = 0; i < 256; ++i) {
     mk_tab[0][i] = m_tab[0][q20((uint8_t)i)];
     mk_tab[1][i] = m_tab[1][q21((uint8_t)i)];
@@ -139,10 +144,10 @@ uint32_t mds_rem(uint32_t p0, uint32_t p1) {
   return p1;
 }
 
-void setkey(uint32_t *in_key) {
+void expand(Context &ctx, const uint32_t *in_key) {
+  auto &s_key = ctx.s_key;
+  auto &l_key = ctx.l_key;
   uint32_t me_key[4], mo_key[4];
-  gen_qtab();
-  gen_mtab();
   for (int i = 0; i < 2; ++i) {
     me_key[i] = in_key[2 * i];
     mo_key[i] = in_key[2 * i + 1];
@@ -156,7 +161,7 @@ void setkey(uint32_t *in_key) {
     l_key[i] = a + b;
     l_key[i + 1] = rotl(a + 2 * b, 9);
   }
-  gen_mk_tab();
+  gen_mk_tab(ctx);
 }
 
 #define g0(x) ( mk_tab[0][BYTE(x,0)] ^ mk_tab[1][BYTE(x,1)] \
@@ -164,7 +169,9 @@ void setkey(uint32_t *in_key) {
 #define g1(x) ( mk_tab[0][BYTE(x,3)] ^ mk_tab[1][BYTE(x,0)] \
                       ^ mk_tab[2][BYTE(x,1)] ^ mk_tab[3][BYTE(x,2)] )
 
-void enc(uint32_t *data) {
+void enc(const Context &ctx, uint32_t *data) {
+  const auto &l_key = ctx.l_key;
+  const auto &mk_tab = ctx.mk_tab;
   uint32_t t0, t1, blk[4];
   for (int i = 0; i < 4; i++)
     blk[i] = data[i] ^ l_key[i];
@@ -181,7 +188,9 @@ void enc(uint32_t *data) {
     data[i] = blk[(i + 2) % 4] ^ l_key[i + 4];
 }
 
-void dec(uint32_t *data) {
+void dec(const Context &ctx, uint32_t *data) {
+  const auto &l_key = ctx.l_key;
+  const auto &mk_tab = ctx.mk_tab;
   uint32_t t0, t1, blk[4];
   for (int i = 0; i < 4; i++)
     blk[i] = data[i] ^ l_key[i + 4];
@@ -201,16 +210,42 @@ void dec(uint32_t *data) {
 
 namespace twofish {
 
-void encrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb) {
+void setkey(Context &ctx, const uint8_t *key, size_t klen) {
+  expand(ctx, (const uint32_t *)key);
+}
+
+void encrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb) {
   memcpy(outb, inb, kBlockSize);
-  setkey((uint32_t *)key);
-  enc((uint32_t *)outb);
+  enc(ctx, (uint32_t *)outb);
 }
 
-void decrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb) {
+void decrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb) {
   memcpy(outb, inb, kBlockSize);
-  setkey((uint32_t *)key);
-  dec((uint32_t *)outb);
+  dec(ctx, (uint32_t *)outb);
+}
+
+void encrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    encrypt(ctx, inb + i * kBlockSize, outb + i * kBlockSize);
+  }
+}
+
+void decrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    decrypt(ctx, inb + i * kBlockSize, outb + i * kBlockSize);
+  }
+}
+
+void encrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb) {
+  Context ctx;
+  setkey(ctx, key, klen);
+  encrypt(ctx, inb, outb);
+}
+
+void decrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb) {
+  Context ctx;
+  setkey(ctx, key, klen);
+  decrypt(ctx, inb, outb);
 }
 
 }
@@ -15,9 +15,29 @@ namespace twofish {
 constexpr size_t kBlockSize = 16;
 constexpr size_t kKeyLength = 16;
 
-void encrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb);
+// Key schedule, expanded by setkey() once for any number of blocks. mk_tab are the key-dependent
+// S-boxes with the MDS matrix folded in, a round is only lookups in them.
+struct Context {
+  uint32_t s_key[2];
+  uint32_t l_key[40];
+  uint32_t mk_tab[4][256];
+};
 
-void decrypt(uint8_t *key, size_t klen, uint8_t *inb, uint8_t *outb);
+void setkey(Context &ctx, const uint8_t *key, size_t klen);
+
+void encrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const Context &ctx, const uint8_t *inb, uint8_t *outb);
+
+// @n independent blocks, in place if @inb == @outb.
+void encrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+void decrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+// Single blocks, expanding @key for each.
+void encrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb);
+
+void decrypt(const uint8_t *key, size_t klen, const uint8_t *inb, uint8_t *outb);
 
 }
 #endif // _TWOFISH_H
@@ -0,0 +1,154 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 lyc
+ */
+
+#include "twofish_avx2.h"
+
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// See aesni.cpp, the binary still runs without AVX2 as long as supported() is checked first.
+#define AVX2 __attribute__((target("avx2")))
+
+namespace {
+
+using twofish::Context;
+using twofish::kBlockSize;
+using twofish_avx2::kLanes;
+
+// Transposes the four words of each of kLanes blocks into a vector per word, or back. Within a
+// vector the blocks end up in the order 0, 2, 4, 6, 1, 3, 5, 7, the same transposition undoes it.
+AVX2 inline void transpose(__m256i &x0, __m256i &x1, __m256i &x2, __m256i &x3) {
+  __m256i t0 = _mm256_unpacklo_epi32(x0, x1);
+  __m256i t1 = _mm256_unpackhi_epi32(x0, x1);
+  __m256i t2 = _mm256_unpacklo_epi32(x2, x3);
+  __m256i t3 = _mm256_unpackhi_epi32(x2, x3);
+  x0 = _mm256_unpacklo_epi64(t0, t2);
+  x1 = _mm256_unpackhi_epi64(t0, t2);
+  x2 = _mm256_unpacklo_epi64(t1, t3);
+  x3 = _mm256_unpackhi_epi64(t1, t3);
+}
+
+AVX2 inline void load(const uint8_t *p, __m256i blk[4]) {
+  for (int i = 0; i < 4; i++) {
+    blk[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32 * i));
+  }
+  transpose(blk[0], blk[1], blk[2], blk[3]);
+}
+
+AVX2 inline void store(__m256i x0, __m256i x1, __m256i x2, __m256i x3, uint8_t *p) {
+  transpose(x0, x1, x2, x3);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), x0);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + 32), x1);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + 64), x2);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + 96), x3);
+}
+
+AVX2 inline __m256i rotl(__m256i x, int n) {
+  return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+AVX2 inline __m256i rotr(__m256i x, int n) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+AVX2 inline __m256i k(const Context &ctx, int i) {
+  return _mm256_set1_epi32(ctx.l_key[i]);
+}
+
+// g0() of twofish.cpp, g1(x) is g0(rotl(x, 8)).
+AVX2 inline __m256i g0(const Context &ctx, __m256i x) {
+  const __m256i byte = _mm256_set1_epi32(0xff);
+  const int *mk0 = reinterpret_cast<const int *>(ctx.mk_tab[0]);
+  const int *mk1 = reinterpret_cast<const int *>(ctx.mk_tab[1]);
+  const int *mk2 = reinterpret_cast<const int *>(ctx.mk_tab[2]);
+  const int *mk3 = reinterpret_cast<const int *>(ctx.mk_tab[3]);
+  __m256i a = _mm256_i32gather_epi32(mk0, _mm256_and_si256(x, byte), 4);
+  __m256i b = _mm256_i32gather_epi32(mk1, _mm256_and_si256(_mm256_srli_epi32(x, 8), byte), 4);
+  __m256i c = _mm256_i32gather_epi32(mk2, _mm256_and_si256(_mm256_srli_epi32(x, 16), byte), 4);
+  __m256i d = _mm256_i32gather_epi32(mk3, _mm256_srli_epi32(x, 24), 4);
+  return _mm256_xor_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(c, d));
+}
+
+AVX2 inline __m256i g1(const Context &ctx, __m256i x) {
+  return g0(ctx, rotl(x, 8));
+}
+
+// The pseudo-Hadamard transform of g's outputs @t0 and @t1 with the round keys @i and @i + 1.
+AVX2 inline void pht(const Context &ctx, __m256i t0, __m256i t1, int i, __m256i &f0, __m256i &f1) {
+  f0 = _mm256_add_epi32(_mm256_add_epi32(t0, t1), k(ctx, i));
+  f1 = _mm256_add_epi32(_mm256_add_epi32(t0, _mm256_add_epi32(t1, t1)), k(ctx, i + 1));
+}
+
+// As enc() and dec() of twofish.cpp.
+AVX2 inline void enc(const Context &ctx, __m256i blk[4]) {
+  __m256i f0, f1;
+  for (int i = 0; i < 4; i++) {
+    blk[i] = _mm256_xor_si256(blk[i], k(ctx, i));
+  }
+  for (int i = 0; i < 8; i++) {
+    pht(ctx, g0(ctx, blk[0]), g1(ctx, blk[1]), 4 * i + 8, f0, f1);
+    blk[2] = rotr(_mm256_xor_si256(blk[2], f0), 1);
+    blk[3] = _mm256_xor_si256(rotl(blk[3], 1), f1);
+    pht(ctx, g0(ctx, blk[2]), g1(ctx, blk[3]), 4 * i + 10, f0, f1);
+    blk[0] = rotr(_mm256_xor_si256(blk[0], f0), 1);
+    blk[1] = _mm256_xor_si256(rotl(blk[1], 1), f1);
+  }
+  for (int i = 0; i < 4; i++) {
+    blk[i] = _mm256_xor_si256(blk[i], k(ctx, (i + 2) % 4 + 4));
+  }
+}
+
+AVX2 inline void dec(const Context &ctx, __m256i blk[4]) {
+  __m256i f0, f1;
+  for (int i = 0; i < 4; i++) {
+    blk[i] = _mm256_xor_si256(blk[i], k(ctx, i + 4));
+  }
+  for (int i = 7; i >= 0; i--) {
+    pht(ctx, g0(ctx, blk[0]), g1(ctx, blk[1]), 4 * i + 10, f0, f1);
+    blk[2] = _mm256_xor_si256(rotl(blk[2], 1), f0);
+    blk[3] = rotr(_mm256_xor_si256(blk[3], f1), 1);
+    pht(ctx, g0(ctx, blk[2]), g1(ctx, blk[3]), 4 * i + 8, f0, f1);
+    blk[0] = _mm256_xor_si256(rotl(blk[0], 1), f0);
+    blk[1] = rotr(_mm256_xor_si256(blk[1], f1), 1);
+  }
+  for (int i = 0; i < 4; i++) {
+    blk[i] = _mm256_xor_si256(blk[i], k(ctx, (i + 2) % 4));
+  }
+}
+
+} // namespace
+
+namespace twofish_avx2 {
+
+bool supported() {
+  // also checks that the OS saves the ymm registers
+  return __builtin_cpu_supports("avx2");
+}
+
+AVX2 void encrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (; n >= kLanes; n -= kLanes, inb += kLanes * kBlockSize, outb += kLanes * kBlockSize) {
+    __m256i blk[4];
+    load(inb, blk);
+    enc(ctx, blk);
+    // the output words are the halves swapped
+    store(blk[2], blk[3], blk[0], blk[1], outb);
+  }
+  twofish::encrypt_blocks(ctx, inb, outb, n);
+}
+
+AVX2 void decrypt_blocks(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n) {
+  for (; n >= kLanes; n -= kLanes, inb += kLanes * kBlockSize, outb += kLanes * kBlockSize) {
+    __m256i blk[4];
+    load(inb, blk);
+    dec(ctx, blk);
+    store(blk[2], blk[3], blk[0], blk[1], outb);
+  }
+  twofish::decrypt_blocks(ctx, inb, outb, n);
+}
+
+}
@@ -0,0 +1,30 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 lyc
+ */
+
+#ifndef _TWOFISH_AVX2_H
+#define _TWOFISH_AVX2_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "twofish.h"
+
+// Twofish on kLanes blocks at once with AVX2, a lane each, the lookups of g in the key's mk_tab
+// done by gathers. Only to be called if supported() says the CPU has AVX2.
+namespace twofish_avx2 {
+
+constexpr size_t kLanes = 8;
+
+bool supported();
+
+// @n independent blocks, in place if @inb == @outb. Fewer than kLanes left are done one by one.
+void encrypt_blocks(const twofish::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+void decrypt_blocks(const twofish::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+
+}
+
+#endif // _TWOFISH_AVX2_H
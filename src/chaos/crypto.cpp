@@ -12,35 +12,92 @@
 #include "buffer.h"
 #include "check.h"
 #include "cipher/aes.h"
+#include "cipher/aesni.h"
 #include "cipher/blowfish.h"
+#include "cipher/blowfish_avx2.h"
 #include "cipher/rc4.h"
 #include "cipher/rsa.h"
 #include "cipher/threefish.h"
 #include "cipher/twofish.h"
+#include "cipher/twofish_avx2.h"
 
 namespace crypto {
 
-Buffer MD5(const Buffer &inb) {
-  Buffer out(MD5_DIGEST_LENGTH);
-  CHECK(out.Allocate());
+namespace {
+
+struct AesImpl {
+  void (*encrypt)(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb);
+  void (*decrypt)(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb);
+  void (*encrypt_blocks)(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+  void (*decrypt_blocks)(const aes::Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+};
+
+constexpr AesImpl kAesPortable = { aes::encrypt, aes::decrypt, aes::encrypt_blocks,
+                                   aes::decrypt_blocks };
+constexpr AesImpl kAesNi = { aesni::encrypt, aesni::decrypt, aesni::encrypt_blocks,
+                             aesni::decrypt_blocks };
+
+// Whole blocks of a cipher without a faster single-block implementation.
+template <typename Context>
+struct BlocksImpl {
+  void (*encrypt_blocks)(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+  void (*decrypt_blocks)(const Context &ctx, const uint8_t *inb, uint8_t *outb, size_t n);
+};
+
+constexpr BlocksImpl<blowfish::Context> kBlowfishPortable = { blowfish::encrypt_blocks,
+                                                               blowfish::decrypt_blocks };
+constexpr BlocksImpl<blowfish::Context> kBlowfishAvx2 = { blowfish_avx2::encrypt_blocks,
+                                                           blowfish_avx2::decrypt_blocks };
+constexpr BlocksImpl<twofish::Context> kTwofishPortable = { twofish::encrypt_blocks,
+                                                             twofish::decrypt_blocks };
+constexpr BlocksImpl<twofish::Context> kTwofishAvx2 = { twofish_avx2::encrypt_blocks,
+                                                         twofish_avx2::decrypt_blocks };
+
+// picked by Init()
+const AesImpl *aes_impl = &kAesPortable;
+const BlocksImpl<blowfish::Context> *blowfish_impl = &kBlowfishPortable;
+const BlocksImpl<twofish::Context> *twofish_impl = &kTwofishPortable;
+
+} // namespace
+
+void Init(bool portable) {
+  if (portable)
+    return;
+  if (aesni::supported())
+    aes_impl = &kAesNi;
+  if (blowfish_avx2::supported())
+    blowfish_impl = &kBlowfishAvx2;
+  if (twofish_avx2::supported())
+    twofish_impl = &kTwofishAvx2;
+}
+
+static_assert(kMD5Length == MD5_DIGEST_LENGTH);
+static_assert(kSHA256Length == SHA256_DIGEST_LENGTH);
+
+void MD5(BufferView inb, Buffer &outb) {
+  CHECK(outb.size() == kMD5Length);
   MD5_CTX ctx;
   MD5_Init(&ctx);
   MD5_Update(&ctx, inb.ptr(), inb.size());
-  MD5_Final(out.ptr(), &ctx);
-  return out;
+  MD5_Final(outb.ptr(), &ctx);
 }
 
-Buffer SHA256(const Buffer &inb) {
-  Buffer out(SHA256_DIGEST_LENGTH);
-  CHECK(out.Allocate());
+void SHA256(BufferView inb, Buffer &outb) {
+  CHECK(outb.size() == kSHA256Length);
   SHA256_CTX ctx;
   SHA256_Init(&ctx);
   SHA256_Update(&ctx, inb.ptr(), inb.size());
-  SHA256_Final(out.ptr(), &ctx);
+  SHA256_Final(outb.ptr(), &ctx);
+}
+
+Buffer SHA256(BufferView inb) {
+  Buffer out(SHA256_DIGEST_LENGTH);
+  CHECK(out.Allocate());
+  SHA256(inb, out);
   return out;
 }
 
-Buffer RSA_encrypt(const Buffer &N, const Buffer &E, const Buffer &inb) {
+Buffer RSA_encrypt(BufferView N, BufferView E, BufferView inb) {
   Buffer out(N.size());
   CHECK(out.Allocate());
   CHECK(inb.size() <= N.size());
@@ -48,7 +105,7 @@ Buffer RSA_encrypt(const Buffer &N, const Buffer &E, const Buffer &inb) {
   return out;
 }
 
-Buffer RSA_decrypt(const Buffer &N, const Buffer &D, const Buffer &inb) {
+Buffer RSA_decrypt(BufferView N, BufferView D, BufferView inb) {
   Buffer out(N.size());
   CHECK(out.Allocate());
   CHECK(inb.size() <= N.size());
@@ -56,100 +113,109 @@ Buffer RSA_decrypt(const Buffer &N, const Buffer &D, const Buffer &inb) {
   return out;
 }
 
-Buffer AES_encrypt(const Buffer &key, const Buffer &inb) {
+void AES_setkey(BufferView key, aes::Context &ctx) {
   CHECK(key.size() == aes::kKeyLength);
-  CHECK(inb.size() <= aes::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  aes::encrypt(key.ptr(), inb.ptr(), outb.ptr());
-  return outb;
+  aes::setkey(ctx, key.ptr());
 }
 
-Buffer AES_decrypt(const Buffer &key, const Buffer &inb) {
-  CHECK(key.size() == aes::kKeyLength);
-  CHECK(inb.size() <= aes::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  aes::decrypt(key.ptr(), inb.ptr(), outb.ptr());
-  return outb;
+void AES_encrypt(const aes::Context &ctx, BufferView inb, Buffer &outb) {
+  CHECK(inb.size() <= aes::kBlockSize || inb.size() % aes::kBlockSize == 0);
+  CHECK(outb.size() == inb.size());
+  if (inb.size() <= aes::kBlockSize)
+    aes_impl->encrypt(ctx, inb.ptr(), outb.ptr());
+  else
+    aes_impl->encrypt_blocks(ctx, inb.ptr(), outb.ptr(), inb.size() / aes::kBlockSize);
 }
 
-Buffer RC4_encrypt(const Buffer &key, const Buffer &inb) {
+void AES_decrypt(const aes::Context &ctx, BufferView inb, Buffer &outb) {
+  CHECK(inb.size() <= aes::kBlockSize || inb.size() % aes::kBlockSize == 0);
+  CHECK(outb.size() == inb.size());
+  if (inb.size() <= aes::kBlockSize)
+    aes_impl->decrypt(ctx, inb.ptr(), outb.ptr());
+  else
+    aes_impl->decrypt_blocks(ctx, inb.ptr(), outb.ptr(), inb.size() / aes::kBlockSize);
+}
+
+void RC4_encrypt(BufferView key, BufferView inb, Buffer &outb) {
   CHECK(key.size() > 0);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
+  CHECK(outb.size() == inb.size());
   rc4::encrypt(key.ptr(), key.size(), inb.ptr(), inb.size(), outb.ptr());
-  return outb;
 }
 
-Buffer RC4_decrypt(const Buffer &key, const Buffer &inb) {
+void RC4_decrypt(BufferView key, BufferView inb, Buffer &outb) {
   CHECK(key.size() > 0);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
+  CHECK(outb.size() == inb.size());
   rc4::decrypt(key.ptr(), key.size(), inb.ptr(), inb.size(), outb.ptr());
-  return outb;
 }
 
-Buffer BLOWFISH_encrypt(const Buffer &key, const Buffer &inb) {
+void BLOWFISH_setkey(BufferView key, bool convert, blowfish::Context &ctx) {
   CHECK(key.size() % sizeof(uint32_t) == 0);
   CHECK(0 < key.size() && key.size() <= blowfish::kMaxKeyLength);
+  blowfish::setkey(ctx, key.ptr(), key.size(), convert);
+}
+
+void BLOWFISH_encrypt(const blowfish::Context &ctx, BufferView inb, Buffer &outb) {
   CHECK(inb.size() % sizeof(uint32_t) == 0);
-  CHECK(inb.size() <= blowfish::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  blowfish::encrypt(key.ptr(), key.size(), inb.ptr(), outb.ptr());
-  return outb;
+  CHECK(inb.size() <= blowfish::kBlockSize || inb.size() % blowfish::kBlockSize == 0);
+  CHECK(outb.size() == inb.size());
+  if (inb.size() <= blowfish::kBlockSize)
+    blowfish::encrypt(ctx, inb.ptr(), outb.ptr());
+  else
+    blowfish_impl->encrypt_blocks(ctx, inb.ptr(), outb.ptr(), inb.size() / blowfish::kBlockSize);
 }
 
-Buffer BLOWFISH_decrypt(const Buffer &key, const Buffer &inb) {
-  CHECK(key.size() % sizeof(uint32_t) == 0);
-  CHECK(0 < key.size() && key.size() <= blowfish::kMaxKeyLength);
+void BLOWFISH_decrypt(const blowfish::Context &ctx, BufferView inb, Buffer &outb) {
   CHECK(inb.size() % sizeof(uint32_t) == 0);
-  CHECK(inb.size() <= blowfish::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  blowfish::decrypt(key.ptr(), key.size(), inb.ptr(), outb.ptr());
-  return outb;
+  CHECK(inb.size() <= blowfish::kBlockSize || inb.size() % blowfish::kBlockSize == 0);
+  CHECK(outb.size() == inb.size());
+  if (inb.size() <= blowfish::kBlockSize)
+    blowfish::decrypt(ctx, inb.ptr(), outb.ptr());
+  else
+    blowfish_impl->decrypt_blocks(ctx, inb.ptr(), outb.ptr(), inb.size() / blowfish::kBlockSize);
 }
 
-Buffer TWOFISH_encrypt(const Buffer &key, const Buffer &inb) {
+void TWOFISH_setkey(BufferView key, twofish::Context &ctx) {
   CHECK(key.size() == twofish::kKeyLength);
+  twofish::setkey(ctx, key.ptr(), key.size());
+}
+
+void TWOFISH_encrypt(const twofish::Context &ctx, BufferView inb, Buffer &outb) {
   CHECK(inb.size() % sizeof(uint32_t) == 0);
-  CHECK(inb.size() <= twofish::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  twofish::encrypt(key.ptr(), key.size(), inb.ptr(), outb.ptr());
-  return outb;
+  CHECK(inb.size() <= twofish::kBlockSize || inb.size() % twofish::kBlockSize == 0);
+  CHECK(outb.size() == inb.size());
+  if (inb.size() <= twofish::kBlockSize)
+    twofish::encrypt(ctx, inb.ptr(), outb.ptr());
+  else
+    twofish_impl->encrypt_blocks(ctx, inb.ptr(), outb.ptr(), inb.size() / twofish::kBlockSize);
 }
 
-Buffer TWOFISH_decrypt(const Buffer &key, const Buffer &inb) {
-  CHECK(key.size() == twofish::kKeyLength);
+void TWOFISH_decrypt(const twofish::Context &ctx, BufferView inb, Buffer &outb) {
   CHECK(inb.size() % sizeof(uint32_t) == 0);
-  CHECK(inb.size() <= twofish::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  twofish::decrypt(key.ptr(), key.size(), inb.ptr(), outb.ptr());
-  return outb;
+  CHECK(inb.size() <= twofish::kBlockSize || inb.size() % twofish::kBlockSize == 0);
+  CHECK(outb.size() == inb.size());
+  if (inb.size() <= twofish::kBlockSize)
+    twofish::decrypt(ctx, inb.ptr(), outb.ptr());
+  else
+    twofish_impl->decrypt_blocks(ctx, inb.ptr(), outb.ptr(), inb.size() / twofish::kBlockSize);
 }
 
-Buffer THREEFISH_encrypt(const Buffer &key, const Buffer &inb) {
+void THREEFISH_setkey(BufferView key, threefish::Context &ctx) {
   CHECK(key.size() == threefish::kKeyLength);
+  threefish::setkey(ctx, key.ptr(), key.size());
+}
+
+void THREEFISH_encrypt(const threefish::Context &ctx, BufferView inb, Buffer &outb) {
   CHECK(inb.size() % sizeof(uint64_t) == 0);
   CHECK(inb.size() <= threefish::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  threefish::encrypt(key.ptr(), key.size(), inb.ptr(), outb.ptr());
-  return outb;
+  CHECK(outb.size() == inb.size());
+  threefish::encrypt(ctx, inb.ptr(), outb.ptr());
 }
 
-Buffer THREEFISH_decrypt(const Buffer &key, const Buffer &inb) {
-  CHECK(key.size() == threefish::kKeyLength);
+void THREEFISH_decrypt(const threefish::Context &ctx, BufferView inb, Buffer &outb) {
   CHECK(inb.size() % sizeof(uint64_t) == 0);
   CHECK(inb.size() <= threefish::kBlockSize);
-  Buffer outb(inb.size());
-  CHECK(outb.Allocate());
-  threefish::decrypt(key.ptr(), key.size(), inb.ptr(), outb.ptr());
-  return outb;
+  CHECK(outb.size() == inb.size());
+  threefish::decrypt(ctx, inb.ptr(), outb.ptr());
 }
 
 }
@@ -8,36 +8,67 @@
 #define _CRYPTO_H
 
 #include "buffer.h"
+#include "cipher/aes.h"
+#include "cipher/blowfish.h"
+#include "cipher/threefish.h"
+#include "cipher/twofish.h"
 
 namespace crypto {
 
-Buffer MD5(const Buffer &inb);
+constexpr uint32_t kMD5Length = 16;
+constexpr uint32_t kSHA256Length = 32;
 
-Buffer SHA256(const Buffer &inb);
+// Functions taking @outb write the result into a caller-provided buffer, which must be allocated
+// (or borrowed) with the exact output size: the digest length for hashes, inb.size() otherwise.
+//
+// Block ciphers take the key schedule @ctx, expanded from a key by their *_setkey() once for any
+// number of calls.
 
-Buffer RSA_encrypt(const Buffer &N, const Buffer &E, const Buffer &inb);
+// Picks the fastest implementations the CPU supports, or keeps the portable ones if @portable.
+// Called once at startup, before threads using them are created.
+void Init(bool portable);
 
-Buffer RSA_decrypt(const Buffer &N, const Buffer &D, const Buffer &inb);
+void MD5(BufferView inb, Buffer &outb);
 
-Buffer AES_encrypt(const Buffer &key, const Buffer &inb);
+void SHA256(BufferView inb, Buffer &outb);
+Buffer SHA256(BufferView inb);
 
-Buffer AES_decrypt(const Buffer &key, const Buffer &inb);
+Buffer RSA_encrypt(BufferView N, BufferView E, BufferView inb);
 
-Buffer RC4_encrypt(const Buffer &key, const Buffer &inb);
+Buffer RSA_decrypt(BufferView N, BufferView D, BufferView inb);
 
-Buffer RC4_decrypt(const Buffer &key, const Buffer &inb);
+void AES_setkey(BufferView key, aes::Context &ctx);
 
-Buffer BLOWFISH_encrypt(const Buffer &key, const Buffer &inb);
+// AES takes a single block, or any number of whole blocks which are each en/decrypted on their own.
+void AES_encrypt(const aes::Context &ctx, BufferView inb, Buffer &outb);
 
-Buffer BLOWFISH_decrypt(const Buffer &key, const Buffer &inb);
+void AES_decrypt(const aes::Context &ctx, BufferView inb, Buffer &outb);
 
-Buffer TWOFISH_encrypt(const Buffer &key, const Buffer &inb);
+void RC4_encrypt(BufferView key, BufferView inb, Buffer &outb);
 
-Buffer TWOFISH_decrypt(const Buffer &key, const Buffer &inb);
+void RC4_decrypt(BufferView key, BufferView inb, Buffer &outb);
 
-Buffer THREEFISH_encrypt(const Buffer &key, const Buffer &inb);
+// Blowfish swaps the byte order of a key before each use, the device does it in place so that the
+// next use swaps it back. BLOWFISH_setkey() expands @key as it is, or as a use leaves it if
+// @convert, without touching it.
+void BLOWFISH_setkey(BufferView key, bool convert, blowfish::Context &ctx);
 
-Buffer THREEFISH_decrypt(const Buffer &key, const Buffer &inb);
+// Blowfish and Twofish take a single block, or any number of whole blocks like AES.
+void BLOWFISH_encrypt(const blowfish::Context &ctx, BufferView inb, Buffer &outb);
+
+void BLOWFISH_decrypt(const blowfish::Context &ctx, BufferView inb, Buffer &outb);
+
+void TWOFISH_setkey(BufferView key, twofish::Context &ctx);
+
+void TWOFISH_encrypt(const twofish::Context &ctx, BufferView inb, Buffer &outb);
+
+void TWOFISH_decrypt(const twofish::Context &ctx, BufferView inb, Buffer &outb);
+
+void THREEFISH_setkey(BufferView key, threefish::Context &ctx);
+
+void THREEFISH_encrypt(const threefish::Context &ctx, BufferView inb, Buffer &outb);
+
+void THREEFISH_decrypt(const threefish::Context &ctx, BufferView inb, Buffer &outb);
 
 }
 
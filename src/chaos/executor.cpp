@@ -0,0 +1,30 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#include "executor.h"
+
+#include <signal.h>
+#include <sys/eventfd.h>
+
+#include "check.h"
+
+Executor::Executor() {
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  CHECK(fd_ >= 0);
+}
+
+Executor::~Executor() {
+  close(fd_);
+}
+
+std::thread Executor::StartThread(std::function<void()> fn) {
+  sigset_t all, old;
+  sigfillset(&all);
+  CHECK(pthread_sigmask(SIG_SETMASK, &all, &old) == 0);
+  std::thread thread(std::move(fn));
+  CHECK(pthread_sigmask(SIG_SETMASK, &old, nullptr) == 0);
+  return thread;
+}
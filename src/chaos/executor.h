@@ -0,0 +1,66 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _EXECUTOR_H
+#define _EXECUTOR_H
+
+#include <functional>
+#include <thread>
+
+// Unit of work run by an Executor. The submitter owns it and keeps it alive until it is reaped.
+class Task {
+ public:
+  virtual ~Task() = default;
+
+  // Runs off the submitting thread, so it must only touch what the submitter leaves alone until
+  // the task is reaped.
+  virtual void Run() = 0;
+  // Runs after Run() on the copy-out stage of a Pipeline, other executors don't call it.
+  virtual void CopyOut() {}
+
+ private:
+  friend class Executor;
+  Task *next_ = nullptr;
+};
+
+// Runs tasks on threads of its own. Tasks complete in any order and are handed back to the
+// submitting thread by Reap(), fd() is readable while some are waiting for it.
+class Executor {
+ public:
+  Executor();
+  virtual ~Executor();
+
+  virtual void Submit(Task *task) = 0;
+
+  // Calls @fn on each task completed since the last call, in completion order.
+  template <typename Fn>
+  void Reap(Fn fn) {
+    Task *task = TakeCompleted();
+    while (task) {
+      Task *next = task->next_;
+      task->next_ = nullptr;
+      fn(task);
+      task = next;
+    }
+  }
+
+  inline int fd() const { return fd_; }
+
+ protected:
+  // Returns the completed tasks linked through next(), after clearing fd().
+  virtual Task *TakeCompleted() = 0;
+
+  // Starts a thread with every signal blocked, so signals such as SIGCHLD stay with the submitting
+  // thread.
+  static std::thread StartThread(std::function<void()> fn);
+
+  static inline Task *&next(Task *task) { return task->next_; }
+
+  // eventfd, written by the threads whenever they complete tasks
+  int fd_;
+};
+
+#endif // _EXECUTOR_H
@@ -4,6 +4,9 @@ void handle_mailbox(void);
 
 void _start()
 {
-    handle_mailbox();
-    syscall(SYS_exit, 0);
+    for (;;) {
+        handle_mailbox();
+        /* parks until the next doorbell */
+        syscall(SYS_chaos_wait);
+    }
 }
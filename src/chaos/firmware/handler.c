@@ -29,14 +29,110 @@ static void unreg(long kh)
     syscall(SYS_chaos_crypto, CHAOS_ALGO_REG_KEY, kh);
 }
 
+/* Handle of the key of a request, @key registered or the key in @slot if not negative. */
+static long key_handle(struct dram_buffer *key, int slot)
+{
+    if (slot < 0)
+        return reg(key);
+    return KEY_HANDLE_SLOT | slot;
+}
+
+/* the job doing what unreg(@kh) does */
+static void unreg_job(struct chaos_job *job, long kh)
+{
+    job->algo = CHAOS_ALGO_REG_KEY;
+    job->in = kh;
+}
+
+/* Responses of this process not pushed yet. */
+#define RSP_BATCH 64
+static struct chaos_mailbox_rsp rsps[RSP_BATCH];
+static uint32_t nrsp;
+
+/*
+ * Requests served by a single crypto call are gathered while a mailbox batch is handled and run
+ * by flush_batch(): one SYS_chaos_cryptov registers their keys, a second one runs the requests and
+ * releases the keys. Their responses are held with the others and patched before being pushed.
+ */
+#define BATCH_MAX (CHAOS_MAX_JOBS / 2)
+
+static struct {
+    uint32_t count;
+    uint32_t nkeys;
+    struct chaos_job keys[BATCH_MAX];
+    /* the requests, followed by an unreg job for each key */
+    struct chaos_job jobs[CHAOS_MAX_JOBS];
+    int key_idx[BATCH_MAX]; /* index into keys, -1 if the request takes no key */
+    uint32_t rsp_idx[BATCH_MAX]; /* index into rsps */
+} batch;
+
+static void flush_batch(void)
+{
+    uint32_t i, n = batch.count, njobs = batch.count;
+    uint32_t kh;
+
+    if (!n)
+        return;
+    if (batch.nkeys)
+        CHECK(syscall(SYS_chaos_cryptov, batch.keys, batch.nkeys) == batch.nkeys);
+    for (i = 0; i < n; i++) {
+        if (batch.key_idx[i] < 0)
+            continue;
+        kh = batch.keys[batch.key_idx[i]].status;
+        batch.jobs[i].key = kh;
+        unreg_job(&batch.jobs[njobs++], kh);
+    }
+    CHECK(syscall(SYS_chaos_cryptov, batch.jobs, njobs) == njobs);
+    for (i = 0; i < n; i++)
+        rsps[batch.rsp_idx[i]].retval = batch.jobs[i].status;
+    batch.count = batch.nkeys = 0;
+}
+
+/*
+ * Queues a request for flush_batch(), @key is NULL if the algorithm takes none and ignored if
+ * @slot is not negative. Returns a placeholder for the response at @rsp_idx.
+ */
+static int defer(enum chaos_request_algo algo, struct dram_buffer in, struct dram_buffer *key,
+                 int slot, struct dram_buffer out, uint32_t rsp_idx)
+{
+    struct chaos_job *job;
+
+    if (batch.count == BATCH_MAX)
+        flush_batch();
+    job = &batch.jobs[batch.count];
+    job->algo = algo;
+    job->in = PACKDB(in);
+    job->out = PACKDB(out);
+    job->key = 0;
+    batch.key_idx[batch.count] = -1;
+    if (key && slot >= 0) {
+        job->key = KEY_HANDLE_SLOT | slot;
+    } else if (key) {
+        batch.keys[batch.nkeys].algo = CHAOS_ALGO_REG_KEY;
+        batch.keys[batch.nkeys].in = PACKDB(*key);
+        batch.key_idx[batch.count] = batch.nkeys++;
+    }
+    batch.rsp_idx[batch.count++] = rsp_idx;
+    return 0;
+}
+
 static int cbc_mode(enum chaos_request_algo algo, struct dram_buffer in, struct dram_buffer key,
-                    struct dram_buffer out, uint32_t block_size)
+                    int slot, struct dram_buffer out, uint32_t block_size)
 {
     uint32_t in_size = in.size;
     uint8_t *in_ptr, *out_ptr, *prev_ptr;
     uint32_t i;
     int ret, tot = 0;
-    long kh = reg(&key);
+    long kh = key_handle(&key, slot);
+    /*
+     * Blowfish converts a registered key in place on each call. A slot is shared by all requests,
+     * so each one starts from the key as loaded and passes the conversion it is at instead.
+     */
+    const int convert = (kh & KEY_HANDLE_SLOT) &&
+                        (algo == CHAOS_ALGO_BF_ENC || algo == CHAOS_ALGO_BF_DEC);
+
+    if (kh < 0)
+        return kh;
 
     for (i = 0; i < in_size; i += block_size) {
         in_ptr = ((uint8_t *)in.ptr) + i;
@@ -44,28 +140,35 @@ static int cbc_mode(enum chaos_request_algo algo, struct dram_buffer in, struct
         if (i != 0)
             xor(in_ptr, prev_ptr, block_size);
         prev_ptr = out_ptr;
+        if (convert)
+            kh ^= KEY_HANDLE_CONVERTED;
         ret = syscall(SYS_chaos_crypto, algo, PACK(in_ptr, block_size), PACK(out_ptr, block_size), kh);
         if (ret < 0)
             return ret;
         tot += ret;
     }
 
-    unreg(kh);
+    if (!(kh & KEY_HANDLE_SLOT))
+        unreg(kh);
     return tot;
 }
 
-static int handle_cmd_request(struct chaos_mailbox_cmd *cmd)
+static int handle_cmd_request(struct chaos_mailbox_cmd *cmd, uint32_t rsp_idx)
 {
     enum chaos_request_algo algo;
-    struct dram_buffer in, key, out;
+    struct dram_buffer in, key = { 0 }, out;
+    int slot = -1;
 
     CHECK(cmd->dma_size == sizeof(struct chaos_request));
     {
         struct chaos_request *req = (struct chaos_request *)DRAM_AT(cmd->dma_addr);
 
-        algo = req->algo;
+        algo = req->algo & ~CHAOS_REQUEST_KEY_SLOT;
         check_dram_buffer(&in, req->input, req->in_size);
-        check_dram_buffer(&key, req->key, req->key_size);
+        if (req->algo & CHAOS_REQUEST_KEY_SLOT)
+            slot = req->key & ~KEY_HANDLE_SLOT;
+        else
+            check_dram_buffer(&key, req->key, req->key_size);
         check_dram_buffer(&out, req->output, req->out_size);
     }
 
@@ -78,113 +181,179 @@ static int handle_cmd_request(struct chaos_mailbox_cmd *cmd)
     case CHAOS_ALGO_MD5:
         if (out.size < 0x10)
             return -EOVERFLOW;
-        return syscall(SYS_chaos_crypto, CHAOS_ALGO_MD5, PACKDB(in), PACKDB(out));
+        return defer(CHAOS_ALGO_MD5, in, NULL, -1, out, rsp_idx);
     case CHAOS_ALGO_SHA256:
         if (out.size < 0x20)
             return -EOVERFLOW;
-        return syscall(SYS_chaos_crypto, CHAOS_ALGO_SHA256, PACKDB(in), PACKDB(out));
+        return defer(CHAOS_ALGO_SHA256, in, NULL, -1, out, rsp_idx);
     case CHAOS_ALGO_RC4_ENC:
         if (out.size < in.size)
             return -EOVERFLOW;
-        {
-            uint32_t kh = reg(&key);
-            long ret = syscall(SYS_chaos_crypto, CHAOS_ALGO_RC4_ENC, PACKDB(in), PACKDB(out), kh);
-            unreg(kh);
-            return ret;
-        }
+        return defer(CHAOS_ALGO_RC4_ENC, in, &key, slot, out, rsp_idx);
     case CHAOS_ALGO_RC4_DEC:
         if (out.size < in.size)
             return -EOVERFLOW;
-        {
-            uint32_t kh = reg(&key);
-            long ret = syscall(SYS_chaos_crypto, CHAOS_ALGO_RC4_DEC, PACKDB(in), PACKDB(out), kh);
-            unreg(kh);
-            return ret;
-        }
+        return defer(CHAOS_ALGO_RC4_DEC, in, &key, slot, out, rsp_idx);
     case CHAOS_ALGO_AES_ENC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % AES_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_AES_ENC, in, key, out, AES_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_AES_ENC, in, key, slot, out, AES_BLOCK_SIZE);
     case CHAOS_ALGO_AES_DEC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % AES_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_AES_DEC, in, key, out, AES_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_AES_DEC, in, key, slot, out, AES_BLOCK_SIZE);
     case CHAOS_ALGO_BF_ENC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % BLOWFISH_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_BF_ENC, in, key, out, BLOWFISH_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_BF_ENC, in, key, slot, out, BLOWFISH_BLOCK_SIZE);
     case CHAOS_ALGO_BF_DEC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % BLOWFISH_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_BF_DEC, in, key, out, BLOWFISH_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_BF_DEC, in, key, slot, out, BLOWFISH_BLOCK_SIZE);
     case CHAOS_ALGO_TF_ENC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % TWOFISH_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_TF_ENC, in, key, out, TWOFISH_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_TF_ENC, in, key, slot, out, TWOFISH_BLOCK_SIZE);
     case CHAOS_ALGO_TF_DEC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % TWOFISH_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_TF_DEC, in, key, out, TWOFISH_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_TF_DEC, in, key, slot, out, TWOFISH_BLOCK_SIZE);
     case CHAOS_ALGO_FFF_ENC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % THREEFISH_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_FFF_ENC, in, key, out, THREEFISH_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_FFF_ENC, in, key, slot, out, THREEFISH_BLOCK_SIZE);
     case CHAOS_ALGO_FFF_DEC:
         if (out.size < in.size)
             return -EOVERFLOW;
         if (in.size % THREEFISH_BLOCK_SIZE != 0)
             return -EINVAL;
-        return cbc_mode(CHAOS_ALGO_FFF_DEC, in, key, out, THREEFISH_BLOCK_SIZE);
+        return cbc_mode(CHAOS_ALGO_FFF_DEC, in, key, slot, out, THREEFISH_BLOCK_SIZE);
     default:
         CHECK(false);
         return 0;
     }
 }
 
-static int handle_cmd(struct chaos_mailbox_cmd *cmd)
+static int handle_cmd_key(struct chaos_mailbox_cmd *cmd)
 {
-    CHECK(cmd->code == CHAOS_CMD_CODE_REQUEST);
-    return handle_cmd_request(cmd);
+    struct chaos_mailbox_key mkey;
+    struct dram_buffer key;
+
+    CHECK(cmd->dma_size == sizeof(struct chaos_mailbox_key));
+    mkey = *(struct chaos_mailbox_key *)DRAM_AT(cmd->dma_addr);
+    if (cmd->code == CHAOS_CMD_CODE_KEY_DESTROY)
+        return syscall(SYS_chaos_crypto, CHAOS_ALGO_DESTROY_SLOT, 0, 0, mkey.slot);
+    check_dram_buffer(&key, mkey.key, mkey.key_size);
+    return syscall(SYS_chaos_crypto, CHAOS_ALGO_LOAD_SLOT, PACKDB(key), 0, mkey.slot);
 }
 
-static void push_rsp(struct chaos_mailbox_rsp *rsp)
+/* @rsp_idx is where the response goes, for requests deferred to flush_batch() */
+static int handle_cmd(struct chaos_mailbox_cmd *cmd, uint32_t rsp_idx)
 {
-    struct chaos_mailbox_rsp *queue = DRAM_AT(csr->rspq_addr);
-    const uint64_t rspq_size = csr->rspq_size;
-    uint64_t tail = csr->rsp_tail;
+    switch (cmd->code) {
+    case CHAOS_CMD_CODE_REQUEST:
+        return handle_cmd_request(cmd, rsp_idx);
+    case CHAOS_CMD_CODE_KEY_LOAD:
+    case CHAOS_CMD_CODE_KEY_DESTROY:
+        return handle_cmd_key(cmd);
+    default:
+        CHECK(false);
+        return 0;
+    }
+}
 
-    queue[real_index(tail, rspq_size)] = *rsp;
-    csr->rsp_tail = queue_inc(tail, rspq_size);
+static struct mailbox_lock *mbox = (struct mailbox_lock *)MAILBOX_LOCK_BASE;
+
+static void lock_mailbox(void)
+{
+    while (__atomic_exchange_n(&mbox->locked, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&mbox->locked, __ATOMIC_RELAXED))
+            __builtin_ia32_pause();
 }
 
-void handle_mailbox(void)
+static void unlock_mailbox(void)
+{
+    __atomic_store_n(&mbox->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Takes the next command, unless the queue is empty or the response queue has no room left for
+ * one more response once those of the commands already taken are pushed.
+ */
+static int take_cmd(struct chaos_mailbox_cmd *cmd)
 {
     const uint64_t cmdq_size = csr->cmdq_size;
-    uint64_t head = csr->cmd_head;
-    uint64_t tail = csr->cmd_tail;
+    const uint64_t rspq_size = csr->rspq_size;
     struct chaos_mailbox_cmd *cmdq = DRAM_AT(csr->cmdq_addr);
-    struct chaos_mailbox_cmd *cmd;
-    struct chaos_mailbox_rsp rsp;
+    uint64_t head, used;
+    int taken = false;
+
+    lock_mailbox();
+    head = csr->cmd_head;
+    used = queue_used(__atomic_load_n(&csr->rsp_head, __ATOMIC_ACQUIRE), csr->rsp_tail, rspq_size);
+    if (head != __atomic_load_n(&csr->cmd_tail, __ATOMIC_ACQUIRE) &&
+        used + mbox->inflight < rspq_size) {
+        *cmd = cmdq[real_index(head, cmdq_size)];
+        /* the slot is free for the guest once the command is copied */
+        __atomic_store_n(&csr->cmd_head, queue_inc(head, cmdq_size), __ATOMIC_RELEASE);
+        mbox->inflight++;
+        taken = true;
+    }
+    unlock_mailbox();
+    return taken;
+}
 
-    if (head == tail)
+/* Completes the deferred requests and pushes all the held responses with one rsp_tail update. */
+static void push_rsps(void)
+{
+    struct chaos_mailbox_rsp *queue = DRAM_AT(csr->rspq_addr);
+    const uint64_t rspq_size = csr->rspq_size;
+    uint64_t tail;
+    uint32_t i;
+
+    flush_batch();
+    if (!nrsp)
         return;
-    cmd = &cmdq[real_index(head, cmdq_size)];
-    csr->cmd_head = queue_inc(head, cmdq_size);
-    rsp.retval = handle_cmd(cmd);
-    rsp.seq = cmd->seq;
-    push_rsp(&rsp);
+    lock_mailbox();
+    tail = csr->rsp_tail;
+    for (i = 0; i < nrsp; i++) {
+        queue[real_index(tail, rspq_size)] = rsps[i];
+        tail = queue_inc(tail, rspq_size);
+    }
+    mbox->inflight -= nrsp;
+    __atomic_store_n(&csr->rsp_tail, tail, __ATOMIC_RELEASE);
+    unlock_mailbox();
+    nrsp = 0;
+}
+
+/*
+ * Serves pending commands until the queue is empty, including those queued while serving. Other
+ * firmware processes may serve the same queue at once, each command is taken by one of them and
+ * responses are pushed in completion order.
+ */
+void handle_mailbox(void)
+{
+    struct chaos_mailbox_cmd cmd;
+
+    while (take_cmd(&cmd)) {
+        rsps[nrsp].retval = handle_cmd(&cmd, nrsp);
+        rsps[nrsp].seq = cmd.seq;
+        if (++nrsp == RSP_BATCH)
+            push_rsps();
+    }
+    push_rsps();
 }
@@ -9,6 +9,15 @@
 
 enum chaos_command_code {
     CHAOS_CMD_CODE_REQUEST = 1,
+    CHAOS_CMD_CODE_KEY_LOAD = 2,
+    CHAOS_CMD_CODE_KEY_DESTROY = 3,
+};
+
+/* pointed to by the dma_addr of CHAOS_CMD_CODE_KEY_{LOAD,DESTROY} */
+struct chaos_mailbox_key {
+    uint32_t slot;
+    uint32_t key;
+    uint32_t key_size;
 };
 
 struct chaos_mailbox_cmd {
@@ -39,10 +48,20 @@ enum chaos_request_algo {
     CHAOS_ALGO_TF_DEC,
     CHAOS_ALGO_FFF_ENC,
     CHAOS_ALGO_FFF_DEC,
+    /* key slots, the slot is the key handle argument */
+    CHAOS_ALGO_LOAD_SLOT = 251, /* the key argument as for CHAOS_ALGO_REG_KEY */
+    CHAOS_ALGO_DESTROY_SLOT = 252,
     CHAOS_ALGO_REG_KEY = 254,
     CHAOS_ALGO_UNREG_KEY = 255,
 };
 
+/* or'ed into the algo of a request whose key field is a slot */
+#define CHAOS_REQUEST_KEY_SLOT 0x100
+/* or'ed into a slot to use it as a key handle */
+#define KEY_HANDLE_SLOT 0x80000000
+/* or'ed into a slot handle for Blowfish, the key as converted by an odd number of calls */
+#define KEY_HANDLE_CONVERTED 0x40000000
+
 struct chaos_request {
     enum chaos_request_algo algo;
     uint32_t input;
@@ -53,6 +72,34 @@ struct chaos_request {
     uint32_t out_size;
 };
 
+/*
+ * Job descriptor of SYS_chaos_cryptov, keep in sync with ../sandbox.cpp. The first four fields are
+ * the arguments SYS_chaos_crypto would take, status receives what it would return.
+ */
+struct chaos_job {
+    uint64_t algo;
+    uint64_t in; /* PACK(ptr, size), or the key argument of CHAOS_ALGO_{,UN}REG_KEY */
+    uint64_t out; /* PACK(ptr, size) */
+    uint64_t key; /* key handle */
+    long status;
+};
+
+/* most jobs per SYS_chaos_cryptov */
+#define CHAOS_MAX_JOBS 64
+
+/*
+ * Page shared by the firmware processes the sandbox runs at once, keep in sync with ../sandbox.cpp.
+ * The sandbox zeroes it whenever none of them runs.
+ */
+#define MAILBOX_LOCK_BASE 0x205000
+
+struct mailbox_lock {
+    uint32_t locked;
+    uint32_t pad;
+    /* commands taken whose responses are not pushed yet, by all the processes */
+    uint64_t inflight;
+};
+
 struct Csrs {
     uint64_t load_addr;
     uint64_t fw_size;
@@ -67,7 +114,8 @@ struct Csrs {
     uint64_t cmd_tail;
     uint64_t rsp_head;
     uint64_t rsp_tail;
-    uint64_t reserved[3];
+    uint64_t key_slots;
+    uint64_t reserved[2];
 };
 
 struct dram_buffer {
@@ -103,4 +151,10 @@ static inline uint64_t queue_inc(uint64_t val, uint64_t size)
     return (++val) & ((size << 1) - 1);
 }
 
+/* number of entries between head and tail, both wrapping at 2 * size */
+static inline uint64_t queue_used(uint64_t head, uint64_t tail, uint64_t size)
+{
+    return (tail - head) & ((size << 1) - 1);
+}
+
 #endif /* HANDLER_H_ */
@@ -0,0 +1,51 @@
+#include "ring.h"
+#include "syscall.h"
+#include "types.h"
+
+static struct chaos_ring *ring = (struct chaos_ring *)RING_BASE;
+
+int chaos_submit(enum chaos_request_algo algo, struct dram_buffer in, struct dram_buffer out,
+                 uint32_t kh, uint64_t user_data)
+{
+    uint32_t tail = ring->sq_tail;
+    struct chaos_sqe *sqe;
+
+    if (tail - ring->cq_head >= RING_ENTRIES)
+        return -EBUSY;
+    sqe = &ring->sq[tail % RING_ENTRIES];
+    sqe->algo = algo;
+    sqe->key = kh;
+    sqe->in = PACKDB(in);
+    sqe->out = PACKDB(out);
+    sqe->user_data = user_data;
+    __atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    /*
+     * Pairs with the fence in the sandbox after it takes the last entry: either it sees the
+     * new tail, or the ring is seen idle here and the sandbox is notified.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) == tail)
+        syscall(SYS_chaos_submit, 0);
+    return 0;
+}
+
+int chaos_poll(struct chaos_cqe *cqe)
+{
+    uint32_t head = ring->cq_head;
+
+    if (__atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE) == head)
+        return false;
+    *cqe = ring->cq[head % RING_ENTRIES];
+    __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+int chaos_wait_cqe(struct chaos_cqe *cqe)
+{
+    while (!chaos_poll(cqe)) {
+        if (ring->sq_tail == ring->cq_head)
+            return -EINVAL;
+        syscall(SYS_chaos_submit, CHAOS_SUBMIT_WAIT);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include "handler.h"
+#include "types.h"
+
+/*
+ * Crypto submission / completion ring in a page shared with the sandbox, keep in sync with
+ * ../ring.h. Indices are free running, an entry lives at index % RING_ENTRIES.
+ */
+#define RING_BASE 0x204000
+#define RING_ENTRIES 64
+
+/* SYS_chaos_submit flags */
+#define CHAOS_SUBMIT_WAIT 1
+
+struct chaos_sqe {
+    uint32_t algo;
+    uint32_t key; /* key handle */
+    uint64_t in; /* PACK(ptr, size) */
+    uint64_t out; /* PACK(ptr, size) */
+    uint64_t user_data; /* copied to the completion, which may come out of order */
+};
+
+struct chaos_cqe {
+    uint64_t user_data;
+    long res;
+};
+
+struct chaos_ring {
+    uint32_t sq_head; /* advanced by the sandbox once an entry is taken, it may complete later */
+    uint32_t sq_tail;
+    uint32_t cq_head;
+    uint32_t cq_tail; /* advanced by the sandbox */
+    struct chaos_sqe sq[RING_ENTRIES];
+    struct chaos_cqe cq[RING_ENTRIES];
+};
+
+/*
+ * Queues one crypto request, the sandbox is only notified when the ring was idle.
+ * Returns -EBUSY if RING_ENTRIES requests are already in flight.
+ */
+int chaos_submit(enum chaos_request_algo algo, struct dram_buffer in, struct dram_buffer out,
+                 uint32_t kh, uint64_t user_data);
+/* Reaps one completion if there is any, returns whether it did. */
+int chaos_poll(struct chaos_cqe *cqe);
+/* Blocks until a completion can be reaped, returns -EINVAL if nothing is in flight. */
+int chaos_wait_cqe(struct chaos_cqe *cqe);
+
+#endif /* RING_H_ */
@@ -4,6 +4,9 @@
 #define SYS_exit 60
 
 #define SYS_chaos_crypto 0xc8a05
+#define SYS_chaos_wait 0xc8a06
+#define SYS_chaos_submit 0xc8a07
+#define SYS_chaos_cryptov 0xc8a08
 
 long syscall(int sysnr, ...);
 
@@ -1,8 +1,10 @@
 #ifndef _TYPES_H
 #define _TYPES_H
 
+#define EBUSY 16
 #define EINVAL 22
 #define EOVERFLOW 75
+#define NULL ((void *)0)
 #define false 0
 #define true 1
 typedef unsigned char uint8_t;
@@ -7,27 +7,118 @@
 #include "inferior.h"
 
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 
+#include <cerrno>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 
 #include "check.h"
+#include "probes.h"
+
+namespace {
+
+// The wait status waitpid() would have reported.
+int WaitStatus(const siginfo_t &info) {
+  switch (info.si_code) {
+  case CLD_EXITED:
+    return W_EXITCODE(info.si_status, 0);
+  case CLD_KILLED:
+  case CLD_DUMPED:
+    return W_EXITCODE(0, info.si_status);
+  default:
+    return W_STOPCODE(info.si_status);
+  }
+}
+
+} // namespace
+
+Inferior::Inferior(pid_t pid)
+    : pid_(pid), last_status_(0), reaped_(false), sys_(), copy_stats_() {
+  pidfd_ = syscall(SYS_pidfd_open, pid, 0);
+  CHECK(pidfd_ >= 0);
+}
 
 Inferior::~Inferior() {
-  kill(pid_, SIGKILL);
-  waitpid(pid_, nullptr, 0);
+  if (!reaped_) {
+    kill(pid_, SIGKILL);
+    waitpid(pid_, nullptr, 0);
+  }
+  close(pidfd_);
+}
+
+bool Inferior::Read(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+  bool ok = BulkRead(ptr, uptr, size);
+  if (ok)
+    copy_stats_.bulk++;
+  else
+    ok = FallbackRead(ptr, uptr, size);
+  PROBE(read, pid_, uptr, size, ok);
+  return ok;
+}
+
+bool Inferior::Write(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+  bool ok = BulkWrite(ptr, uptr, size);
+  if (ok)
+    copy_stats_.bulk++;
+  else
+    ok = FallbackWrite(ptr, uptr, size);
+  PROBE(write, pid_, uptr, size, ok);
+  return ok;
+}
+
+// process_vm_{readv,writev} honor page protections and may be unavailable (e.g. kernel built
+// without CONFIG_CROSS_MEMORY_ATTACH), any short transfer goes to the Fallback* engines.
+bool Inferior::BulkRead(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+  struct iovec local = { ptr, size };
+  struct iovec remote = { reinterpret_cast<void *>(static_cast<uint64_t>(uptr)), size };
+  ssize_t ret = process_vm_readv(pid_, &local, 1, &remote, 1, 0);
+  debug("0x%x bytes from 0x%x: %zd\n", size, uptr, ret);
+  return ret == static_cast<ssize_t>(size);
 }
 
-void Inferior::Attach() const {
-  CHECK(ptrace(PTRACE_SEIZE, pid_, 0, PTRACE_O_EXITKILL | PTRACE_O_TRACESYSGOOD) == 0);
+bool Inferior::BulkWrite(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+  struct iovec local = { ptr, size };
+  struct iovec remote = { reinterpret_cast<void *>(static_cast<uint64_t>(uptr)), size };
+  ssize_t ret = process_vm_writev(pid_, &local, 1, &remote, 1, 0);
+  debug("0x%x bytes to 0x%x: %zd\n", size, uptr, ret);
+  return ret == static_cast<ssize_t>(size);
+}
+
+std::unique_ptr<Inferior> PtraceInferior::Spawn(void *pc, void *stk,
+                                                const std::function<bool()> &setup) {
+  pid_t pid = fork();
+  if (!pid) {
+    if (!setup())
+      _exit(3);
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    raise(SIGSTOP);
+    // shouldn't reach here
+    _exit(3);
+  }
+
+  auto inferior = std::make_unique<PtraceInferior>(pid);
+  inferior->Attach();
+  inferior->SetContext(pc, stk);
+  return inferior;
+}
+
+// The child has called PTRACE_TRACEME and stopped itself, we only need to catch the stop.
+// PTRACE_SEIZE here would race with the child's PTRACE_TRACEME.
+void PtraceInferior::Attach() const {
   CHECK(waitpid(pid_, nullptr, 0) == pid_);
+  CHECK(ptrace(PTRACE_SETOPTIONS, pid_, 0, PTRACE_O_EXITKILL | PTRACE_O_TRACESYSGOOD) == 0);
 }
 
-void Inferior::SetContext(void *pc, void *stk) const {
+void PtraceInferior::SetContext(void *pc, void *stk) const {
   struct user_regs_struct regs;
   CHECK(ptrace(PTRACE_GETREGS, pid_, 0, &regs) == 0);
   debug("%p %p\n", pc, stk);
@@ -36,17 +127,36 @@ void Inferior::SetContext(void *pc, void *stk) const {
   CHECK(ptrace(PTRACE_SETREGS, pid_, 0, &regs) == 0);
 }
 
-bool Inferior::WaitForSys() {
+void PtraceInferior::Resume() {
+  if (running_)
+    return;
   CHECK(ptrace(PTRACE_SYSEMU, pid_, 0, 0) == 0);
-  CHECK(waitpid(pid_, &last_status_, 0) == pid_);
+  running_ = true;
+}
+
+Inferior::Stop PtraceInferior::Poll(bool block) {
+  Resume();
+  siginfo_t info = {};
+  CHECK(waitid(static_cast<idtype_t>(P_PIDFD), pidfd_, &info,
+               WEXITED | WSTOPPED | __WALL | (block ? 0 : WNOHANG)) == 0);
+  // WNOHANG and nothing to report
+  if (info.si_pid == 0)
+    return Stop::kNone;
+  running_ = false;
+  last_status_ = WaitStatus(info);
+  if (WIFEXITED(last_status_) || WIFSIGNALED(last_status_))
+    reaped_ = true;
   if (!(WIFSTOPPED(last_status_) && WSTOPSIG(last_status_) == (SIGTRAP | 0x80)))
-    return false;
-  CHECK((unsigned long)ptrace(PTRACE_GET_SYSCALL_INFO, pid_, sizeof(sys_), &sys_) <= sizeof(sys_));
-  debug("op=%d 0x%x rip=0x%lx, NR=%ld\n", sys_.op, sys_.arch, sys_.instruction_pointer, sys_.entry.nr);
-  return true;
+    return Stop::kTerminated;
+  CHECK((unsigned long)ptrace(PTRACE_GET_SYSCALL_INFO, pid_, sizeof(info_), &info_) <= sizeof(info_));
+  debug("op=%d 0x%x rip=0x%lx, NR=%ld\n", info_.op, info_.arch, info_.instruction_pointer, info_.entry.nr);
+  sys_.nr = info_.entry.nr;
+  memcpy(sys_.args, info_.entry.args, sizeof(sys_.args));
+  return Stop::kSyscall;
 }
 
-bool Inferior::Read(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+bool PtraceInferior::FallbackRead(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+  copy_stats_.ptrace++;
   uint32_t r = size % sizeof(uint64_t);
   size -= r;
   for (uint32_t i = 0; i < size; i += sizeof(uint64_t)) {
@@ -65,7 +175,8 @@ bool Inferior::Read(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
   return true;
 }
 
-bool Inferior::Write(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+bool PtraceInferior::FallbackWrite(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
+  copy_stats_.ptrace++;
   uint32_t r = size % sizeof(uint64_t);
   size -= r;
   for (uint32_t i = 0; i < size; i += sizeof(uint64_t)) {
@@ -73,15 +184,19 @@ bool Inferior::Write(uint8_t *ptr, uint32_t uptr, uint32_t size) const {
       return false;
     debug("[0x%x] = %lx\n", uptr + i, *reinterpret_cast<uint64_t*>(ptr + i));
   }
+  // merge the trailing bytes into the word already there, one PEEK + one POKE
   if (r) {
-    for (uint32_t i = 0; i < r; ++i) {
-      if (ptrace(PTRACE_POKEDATA, pid_, uptr + size + i, ptr[size + i]))
-        return false;
-    }
+    errno = 0;
+    uint64_t data = ptrace(PTRACE_PEEKDATA, pid_, uptr + size, 0);
+    if (errno)
+      return false;
+    memcpy(&data, ptr + size, r);
+    if (ptrace(PTRACE_POKEDATA, pid_, uptr + size, data))
+      return false;
   }
   return true;
 }
 
-void Inferior::SetSyscallRet(long retval) const {
+void PtraceInferior::SetSyscallRet(long retval) const {
   CHECK(ptrace(PTRACE_POKEUSER, pid_, offsetof(struct user_regs_struct, rax), retval) == 0);
 }
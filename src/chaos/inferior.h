@@ -10,36 +10,114 @@
 #include <sys/types.h>
 
 #include <cstdint>
+#include <functional>
+#include <memory>
 
 #define SYS_exit 60
 #define SYS_exit_group 231
 #define SYS_chaos_crypto 0xc8a05
 #define SYS_chaos_flag 0xc89fc
+#define SYS_chaos_wait 0xc8a06
+#define SYS_chaos_submit 0xc8a07
+#define SYS_chaos_cryptov 0xc8a08
 
+// Number of Read / Write calls served by each copy engine.
+struct CopyStats {
+  uint64_t bulk;
+  uint64_t ptrace;
+};
+
+// A firmware process whose system calls are trapped to the sandbox. The trap mechanism is provided
+// by the subclasses.
 class Inferior {
  public:
-  Inferior(pid_t pid) : pid_(pid), last_status_(0) {}
-  ~Inferior();
+  enum class Stop {
+    // still running, only reported by Poll(false)
+    kNone,
+    // stopped at a system call, see sysnr() and sysargs()
+    kSyscall,
+    // terminated, or stopped by a signal and unable to go on, see lastStatus()
+    kTerminated,
+  };
 
-  void Attach() const;
-  void SetContext(void *pc, void *stk) const;
+  Inferior(pid_t pid);
+  virtual ~Inferior();
 
-  bool WaitForSys();
-  void SetSyscallRet(long retval) const;
+  // Resumes the inferior if it isn't running and reports whether it stopped since. Only returns
+  // once it did if @block.
+  virtual Stop Poll(bool block) = 0;
+  // Readable when Poll() may have something new to report, or -1 if that is announced by
+  // SIGCHLD instead.
+  virtual int fd() const = 0;
+  // Resumes the inferior until its next system call, returns false if it terminated instead.
+  bool WaitForSys() { return Poll(true) == Stop::kSyscall; }
+  virtual void SetSyscallRet(long retval) const = 0;
+  // Lets the inferior run past the current system call before WaitForSys is called, to serve
+  // requests while it runs. Memory is then only reachable through process_vm_{readv,writev}.
+  virtual void Resume() = 0;
 
   bool Read(uint8_t *ptr, uint32_t uptr, uint32_t size) const;
   bool Write(uint8_t *ptr, uint32_t uptr, uint32_t size) const;
+  // Write() without fallback, which unlike ptrace may be used from any thread. Not counted in
+  // copyStats().
+  bool BulkWrite(uint8_t *ptr, uint32_t uptr, uint32_t size) const;
 
-  inline uint64_t sysnr() const { return sys_.entry.nr; }
-  inline const uint64_t *sysargs() const { return sys_.entry.args; }
+  inline pid_t pid() const { return pid_; }
+  inline uint64_t sysnr() const { return sys_.nr; }
+  inline const uint64_t *sysargs() const { return sys_.args; }
   inline bool IsSysCrpyto() const { return sysnr() == SYS_chaos_crypto; }
   inline bool IsSysFlag() const { return sysnr() == SYS_chaos_flag; }
+  inline bool IsSysWait() const { return sysnr() == SYS_chaos_wait; }
+  inline bool IsSysSubmit() const { return sysnr() == SYS_chaos_submit; }
+  inline bool IsSysCryptoVec() const { return sysnr() == SYS_chaos_cryptov; }
   inline bool IsExit() const { return sysnr() == SYS_exit || sysnr() == SYS_exit_group; }
   inline int lastStatus() const { return last_status_; }
+  inline const CopyStats &copyStats() const { return copy_stats_; }
+  inline void clearCopyStats() const { copy_stats_ = {}; }
+
+ protected:
+  // Used when process_vm_{readv,writev} can't serve the request, the default is to fail.
+  virtual bool FallbackRead(uint8_t *ptr, uint32_t uptr, uint32_t size) const { return false; }
+  virtual bool FallbackWrite(uint8_t *ptr, uint32_t uptr, uint32_t size) const { return false; }
 
- private:
   pid_t pid_;
+  int pidfd_;
   int last_status_;
+  // set once pid_ has been waited for, it must not be signaled anymore
+  bool reaped_;
+  struct {
+    uint64_t nr;
+    uint64_t args[6];
+  } sys_;
+  mutable CopyStats copy_stats_;
+
+ private:
+  bool BulkRead(uint8_t *ptr, uint32_t uptr, uint32_t size) const;
+};
+
+// Traps every system call with PTRACE_SYSEMU, none of them reaches the kernel.
+class PtraceInferior : public Inferior {
+ public:
+  PtraceInferior(pid_t pid) : Inferior(pid), running_(false), info_() {}
+
+  // Forks a child that starts executing at pc with stack stk, once @setup succeeded in it.
+  static std::unique_ptr<Inferior> Spawn(void *pc, void *stk, const std::function<bool()> &setup);
+
+  Stop Poll(bool block) override;
+  // ptrace stops don't make the pidfd readable
+  int fd() const override { return -1; }
+  void SetSyscallRet(long retval) const override;
+  void Resume() override;
+
+ protected:
+  bool FallbackRead(uint8_t *ptr, uint32_t uptr, uint32_t size) const override;
+  bool FallbackWrite(uint8_t *ptr, uint32_t uptr, uint32_t size) const override;
+
+ private:
+  void Attach() const;
+  void SetContext(void *pc, void *stk) const;
+
+  bool running_;
   struct {
     uint8_t op;	/* PTRACE_SYSCALL_INFO_* */
     uint32_t arch __attribute__((__aligned__(sizeof(uint32_t))));
@@ -60,7 +138,7 @@ class Inferior {
         uint32_t ret_data;
       } seccomp;
     };
-  } sys_;
+  } info_;
 };
 
 #endif // _INFERIOR_H
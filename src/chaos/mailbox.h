@@ -0,0 +1,62 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _MAILBOX_H
+#define _MAILBOX_H
+
+#include <cstdint>
+
+// What the guest driver and the device exchange, keep in sync with QEMU's chaos.c and the driver's
+// chaos-mailbox.h and chaos.h.
+
+struct Csrs {
+  uint64_t load_addr, fw_size;
+  uint64_t cmdq_addr, rspq_addr, cmdq_size, rspq_size;
+  uint64_t irq_status, clear_irq, cmd_sent;
+  uint64_t cmd_head, cmd_tail, rsp_head, rsp_tail;
+  uint64_t key_slots;
+  uint64_t reserved[2];
+};
+
+struct MailboxCmd {
+  uint16_t seq;
+  uint16_t pad;
+  uint8_t code;
+  uint32_t dma_addr;
+  uint32_t dma_size;
+} __attribute__((packed));
+
+struct MailboxRsp {
+  uint16_t seq;
+  uint32_t retval;
+} __attribute__((packed));
+
+// struct chaos_request, pointed to by the dma_addr of a command
+struct Request {
+  uint32_t algo;
+  uint32_t input, in_size;
+  uint32_t key, key_size;
+  uint32_t output, out_size;
+};
+
+// struct chaos_mailbox_key, pointed to by the dma_addr of kCmdCodeKeyLoad and kCmdCodeKeyDestroy
+struct MailboxKey {
+  uint32_t slot;
+  uint32_t key, key_size;
+};
+
+constexpr uint8_t kCmdCodeRequest = 1;
+constexpr uint8_t kCmdCodeKeyLoad = 2;
+constexpr uint8_t kCmdCodeKeyDestroy = 3;
+
+// Or'ed into Request::algo, the key is then the slot loaded by kCmdCodeKeyLoad.
+constexpr uint32_t kRequestKeySlot = 0x100;
+
+// Entries in each queue as the driver sets them up. Head and tail indices run up to twice as far,
+// an entry lives at index % size.
+constexpr uint32_t kQueueSize = 512;
+
+#endif // _MAILBOX_H
@@ -0,0 +1,94 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#include "pipeline.h"
+
+#include <sys/eventfd.h>
+
+#include <cstdint>
+
+#include "check.h"
+
+Pipeline::Pipeline(uint32_t capacity)
+    : stopping_(false), queues_{Queue(capacity), Queue(capacity), Queue(capacity)} {
+  for (int stage = kCompute; stage < kRespond; stage++) {
+    queues_[stage].fd = eventfd(0, EFD_CLOEXEC);
+    CHECK(queues_[stage].fd >= 0);
+  }
+  queues_[kRespond].fd = fd_;
+  for (int stage = kCompute; stage < kRespond; stage++)
+    threads_[stage] = StartThread([this, stage] { Loop(static_cast<Stage>(stage)); });
+}
+
+Pipeline::~Pipeline() {
+  stopping_.store(true);
+  for (int stage = kCompute; stage < kRespond; stage++) {
+    uint64_t one = 1;
+    CHECK(write(queues_[stage].fd, &one, sizeof(one)) == sizeof(one));
+    threads_[stage].join();
+    close(queues_[stage].fd);
+  }
+}
+
+void Pipeline::Submit(Task *task) {
+  Push(kCompute, task);
+}
+
+StageStats Pipeline::stats(Stage stage) const {
+  const Queue &q = queues_[stage];
+  return { q.tasks.load(std::memory_order_relaxed), q.occupancy.load(std::memory_order_relaxed),
+           q.max_occupancy.load(std::memory_order_relaxed) };
+}
+
+void Pipeline::Push(Stage stage, Task *task) {
+  Queue &q = queues_[stage];
+  // in flight tasks are bounded by the capacity, so none of the rings can be full
+  CHECK(q.ring.Push(task));
+  uint64_t occupancy = q.ring.size();
+  q.tasks.store(q.tasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  q.occupancy.store(q.occupancy.load(std::memory_order_relaxed) + occupancy,
+                    std::memory_order_relaxed);
+  if (occupancy > q.max_occupancy.load(std::memory_order_relaxed))
+    q.max_occupancy.store(occupancy, std::memory_order_relaxed);
+  // one wakeup per task, so that the next stage starts on it right away
+  uint64_t one = 1;
+  CHECK(write(q.fd, &one, sizeof(one)) == sizeof(one));
+}
+
+void Pipeline::Loop(Stage stage) {
+  Queue &q = queues_[stage];
+  while (1) {
+    // every task is counted on the eventfd after it is pushed, none is missed by draining the
+    // ring after the read
+    uint64_t count;
+    CHECK(read(q.fd, &count, sizeof(count)) == sizeof(count));
+    if (stopping_.load())
+      return;
+    Task *task;
+    while (q.ring.Pop(task)) {
+      if (stage == kCompute) {
+        task->Run();
+        Push(kCopyOut, task);
+      } else {
+        task->CopyOut();
+        Push(kRespond, task);
+      }
+    }
+  }
+}
+
+Task *Pipeline::TakeCompleted() {
+  uint64_t count;
+  if (read(fd_, &count, sizeof(count)) != sizeof(count))
+    return nullptr;
+  Task *head = nullptr, **link = &head;
+  Task *task;
+  while (queues_[kRespond].ring.Pop(task)) {
+    *link = task;
+    link = &next(task);
+  }
+  return head;
+}
@@ -0,0 +1,73 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "executor.h"
+#include "spsc.h"
+
+// Occupancy of the queue in front of a stage, sampled whenever a task is queued. A stage whose
+// queue keeps filling up is the bottleneck. Published in the stats page by the sandbox.
+struct StageStats {
+  uint64_t tasks;
+  // sum of the queue lengths seen, divided by tasks it is the mean occupancy
+  uint64_t occupancy;
+  uint64_t max_occupancy;
+};
+
+// Runs each task through stages of one thread each, connected by SpscRings: Run() on the compute
+// stage then CopyOut() on the copy-out stage, then back to the submitter. So the copy of a task
+// overlaps the compute of the next one, which itself overlaps the submitter preparing the one
+// after.
+class Pipeline : public Executor {
+ public:
+  enum Stage {
+    kCompute,
+    kCopyOut,
+    // completed, waiting for the submitter to reap it
+    kRespond,
+    kNumStages,
+  };
+
+  // At most @capacity tasks may be in flight, it must be a power of two.
+  explicit Pipeline(uint32_t capacity);
+  ~Pipeline() override;
+
+  void Submit(Task *task) override;
+
+  StageStats stats(Stage stage) const;
+
+ protected:
+  Task *TakeCompleted() override;
+
+ private:
+  struct Queue {
+    explicit Queue(uint32_t capacity) : ring(capacity), tasks(0), occupancy(0), max_occupancy(0) {}
+
+    SpscRing<Task *> ring;
+    // eventfd counting the tasks pushed, the consumer sleeps on it, except for kRespond's which
+    // is fd_
+    int fd;
+    // written by the producer only
+    std::atomic<uint64_t> tasks, occupancy, max_occupancy;
+  };
+
+  // Queues @task for @stage and wakes up its thread.
+  void Push(Stage stage, Task *task);
+  // Runs @stage until the pipeline stops.
+  void Loop(Stage stage);
+
+  std::atomic<bool> stopping_;
+  Queue queues_[kNumStages];
+  std::thread threads_[kRespond];
+};
+
+#endif // _PIPELINE_H
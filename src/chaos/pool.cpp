@@ -0,0 +1,101 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#include "pool.h"
+
+#include <cstdint>
+
+#include "check.h"
+
+Pool::Pool(uint32_t threads)
+    : deal_(0), queued_(0), steals_(0), stopping_(false), done_head_(nullptr), done_tail_(nullptr) {
+  for (uint32_t i = 0; i < threads; i++)
+    queues_.push_back(std::make_unique<Queue>());
+  for (uint32_t i = 0; i < threads; i++)
+    threads_.push_back(StartThread([this, i] { Loop(i); }));
+}
+
+Pool::~Pool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  for (auto &thread : threads_)
+    thread.join();
+}
+
+void Pool::Submit(Task *task) {
+  Queue &queue = *queues_[deal_];
+  deal_ = (deal_ + 1) % queues_.size();
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_++;
+  }
+  cond_.notify_one();
+}
+
+Task *Pool::Take(uint32_t self) {
+  const uint32_t n = queues_.size();
+  for (uint32_t i = 0; i < n; i++) {
+    Queue &queue = *queues_[(self + i) % n];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      continue;
+    Task *task;
+    if (i == 0) {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    } else {
+      // the task its owner would get to last
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+      steals_.fetch_add(1, std::memory_order_relaxed);
+    }
+    queued_--;
+    return task;
+  }
+  return nullptr;
+}
+
+void Pool::Loop(uint32_t self) {
+  while (1) {
+    Task *task = Take(self);
+    if (!task) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+      if (stopping_)
+        return;
+      continue;
+    }
+    task->Run();
+    std::lock_guard<std::mutex> lock(done_mutex_);
+    if (done_tail_) {
+      next(done_tail_) = task;
+    } else {
+      // the submitter is only notified when the list becomes non-empty
+      done_head_ = task;
+      uint64_t one = 1;
+      CHECK(write(fd_, &one, sizeof(one)) == sizeof(one));
+    }
+    done_tail_ = task;
+  }
+}
+
+Task *Pool::TakeCompleted() {
+  std::lock_guard<std::mutex> lock(done_mutex_);
+  Task *task = done_head_;
+  if (task) {
+    uint64_t count;
+    CHECK(read(fd_, &count, sizeof(count)) == sizeof(count));
+  }
+  done_head_ = done_tail_ = nullptr;
+  return task;
+}
@@ -0,0 +1,62 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "executor.h"
+
+// Fixed set of threads running tasks, each one from start to end. Tasks are dealt to the threads in
+// turn, a thread out of tasks of its own steals the latest one of another.
+class Pool : public Executor {
+ public:
+  explicit Pool(uint32_t threads);
+  ~Pool() override;
+
+  void Submit(Task *task) override;
+
+  // tasks run by another thread than the one they were dealt to
+  inline uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+ protected:
+  Task *TakeCompleted() override;
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task *> tasks;
+  };
+
+  void Loop(uint32_t self);
+  // Takes the oldest task of queue @self or else the newest one of another queue.
+  Task *Take(uint32_t self);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  // queue the next task is dealt to, only touched by the submitting thread
+  uint32_t deal_;
+  // Tasks in the queues, briefly negative when one is taken before it is counted. Raised with
+  // mutex_ held so that a thread going to sleep can't miss it.
+  std::atomic<int32_t> queued_;
+  std::atomic<uint64_t> steals_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopping_;
+  // completed tasks not reaped yet
+  std::mutex done_mutex_;
+  Task *done_head_, *done_tail_;
+  std::vector<std::thread> threads_;
+};
+
+#endif // _POOL_H
@@ -0,0 +1,31 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _PROBES_H
+#define _PROBES_H
+
+// USDT probes of provider "chaos" for bpftrace and perf, see probes/ for sample scripts. A probe
+// is a single nop until something attaches to it, and nothing at all when <sys/sdt.h> (package
+// systemtap-sdt-dev) is missing.
+//
+//   doorbell(doorbells)                     a doorbell from the host, the count so far
+//   spawn(worker, pid)                      a firmware process started for workers[worker]
+//   exit(worker, pid, failed)               a firmware process gone, crashed or failed if failed
+//   crypto_entry(call, algo, in_size, out)  a crypto call trapped, call identifies it until
+//   crypto_return(call, algo, ret)          it returns ret
+//   read(pid, addr, size, ok)               a copy from firmware memory
+//   write(pid, addr, size, ok)              a copy to firmware memory
+//   verify_entry(size)                      the firmware image being verified
+//   verify_return(ret)                      0 if it was accepted
+#if __has_include(<sys/sdt.h>)
+#define SDT_USE_VARIADIC
+#include <sys/sdt.h>
+#define PROBE(name, ...) STAP_PROBEV(chaos, name, ##__VA_ARGS__)
+#else
+#define PROBE(name, ...) do {} while (0)
+#endif
+
+#endif // _PROBES_H
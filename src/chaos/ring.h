@@ -0,0 +1,43 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <cstdint>
+
+// Crypto submission / completion ring in a page shared with the firmware, keep in sync with
+// firmware/ring.h. Indices are free running, an entry lives at index % kRingEntries.
+constexpr uint32_t kRingEntries = 64;
+
+struct RingSqe {
+  uint32_t algo;
+  uint32_t key; // key handle
+  uint64_t in; // (ptr << 32) | size, as for SYS_chaos_crypto
+  uint64_t out;
+  uint64_t user_data; // copied to the completion, which may come out of order
+};
+
+struct RingCqe {
+  uint64_t user_data;
+  int64_t res;
+};
+
+struct Ring {
+  uint32_t sq_head; // advanced by the sandbox once an entry is taken, it may complete later
+  uint32_t sq_tail; // advanced by the firmware
+  uint32_t cq_head; // advanced by the firmware
+  uint32_t cq_tail; // advanced by the sandbox
+  RingSqe sq[kRingEntries];
+  RingCqe cq[kRingEntries];
+};
+
+// SYS_chaos_submit flags.
+// Returns only after every submitted entry is completed, otherwise entries are completed while the
+// firmware keeps running.
+constexpr uint64_t kSubmitWait = 1;
+
+#endif // _RING_H
@@ -4,31 +4,57 @@
  * Copyright (c) 2021 david942j
  */
 
+#include <getopt.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/fcntl.h>
 #include <sys/mman.h>
-#include <sys/ptrace.h>
-#include <sys/select.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "arena.h"
 #include "buffer.h"
+#include "capture.h"
 #include "check.h"
+#include "cipher/aes.h"
+#include "cipher/blowfish.h"
+#include "cipher/threefish.h"
+#include "cipher/twofish.h"
 #include "crypto.h"
 #include "inferior.h"
+#include "mailbox.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "probes.h"
+#include "ring.h"
 #include "seccomp.h"
+#include "seccomp_inferior.h"
+#include "stats.h"
 
 namespace {
 
 class MemoryRegion {
  public:
-  MemoryRegion(uint64_t base, uint64_t size, int prot) : base_((void *)base), size_(size) {
-    auto ptr = mmap(base_, size_, prot, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+  MemoryRegion(uint64_t base, uint64_t size, int prot, int flags = MAP_PRIVATE)
+      : base_((void *)base), size_(size) {
+    auto ptr = mmap(base_, size_, prot, MAP_ANONYMOUS | flags | MAP_FIXED, -1, 0);
     CHECK(ptr == base_);
   }
 
@@ -54,6 +80,11 @@ class MemoryRegion {
     *static_cast<uint64_t *>(base_ + offset) = val;
   }
 
+  // Faults the whole region in and keeps it in memory, in this process only.
+  void Lock() const {
+    CHECK(mlock(base_, size_) == 0);
+  }
+
   void *at(uint64_t offset) const {
       CHECK(offset < size_);
       return base_ + offset;
@@ -68,24 +99,90 @@ class MemoryRegion {
   uint64_t size_;
 };
 
+struct SpinStats {
+  // waits which saw their event while spinning, and ones which spun in vain and blocked
+  uint64_t hits;
+  uint64_t misses;
+  // waits which blocked right away, spinning being off
+  uint64_t blocking;
+  // current budget in nanoseconds
+  uint64_t budget;
+};
+
+// Polls for a while before a wait blocks, saving the sleep and wakeup when events come in quick
+// succession. The budget doubles on each hit up to the maximum, and halves on each miss down to
+// kMinBudget, so that little is burnt while idle.
+class AdaptiveSpin {
+ public:
+  static constexpr uint64_t kMinBudget = 1000;
+
+  // Calls @poll until it returns true, or returns false once the budget is spent.
+  template <typename Fn>
+  bool Spin(Fn poll) {
+    if (!max_budget_) {
+      stats_.blocking++;
+      return false;
+    }
+    const uint64_t deadline = stats::Now() + stats_.budget;
+    do {
+      if (poll()) {
+        stats_.hits++;
+        stats_.budget = std::min(stats_.budget * 2, max_budget_);
+        return true;
+      }
+    } while (stats::Now() < deadline);
+    stats_.misses++;
+    stats_.budget = std::max(stats_.budget / 2, std::min(kMinBudget, max_budget_));
+    return false;
+  }
+
+  // 0 turns spinning off.
+  void SetMaxBudget(uint64_t ns) {
+    max_budget_ = ns;
+    stats_.budget = ns;
+  }
+
+  inline const SpinStats &stats() const { return stats_; }
+
+ private:
+  uint64_t max_budget_ = 0;
+  SpinStats stats_ = {};
+};
+
+// Spins before the sandbox blocks for the host or the workers, --spin sets the maximum budget.
+AdaptiveSpin spin;
+
 class Event {
  public:
   Event(int fd) : fd_(fd) {
-    CHECK(fd < FD_SETSIZE);
+    int flags = fcntl(fd, F_GETFL);
+    CHECK(flags >= 0);
+    CHECK(fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
   }
   ~Event() {
     close(fd_);
   }
 
   void WaitAndClear() const {
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(fd_, &readfds);
-    int ret = select(fd_ + 1, &readfds, NULL, NULL, NULL);
-    CHECK(ret == 1);
+    if (spin.Spin([this] { return TryClear(); }))
+      return;
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    CHECK(poll(&pfd, 1, -1) == 1);
+    Clear();
+  }
+
+  // For an fd found readable by the caller.
+  void Clear() const {
+    CHECK(TryClear());
+  }
+
+  // Returns false if there is nothing to clear.
+  bool TryClear() const {
     uint64_t dummy;
-    ret = read(fd_, &dummy, sizeof(dummy));
-    CHECK(ret == sizeof(dummy));
+    if (read(fd_, &dummy, sizeof(dummy)) == sizeof(dummy))
+      return true;
+    CHECK(errno == EAGAIN);
+    return false;
   }
 
   void Trigger(uint64_t val = 1) const {
@@ -93,6 +190,8 @@ class Event {
     CHECK(ret == sizeof(val));
   }
 
+  inline int fd() const { return fd_; }
+
  private:
   int fd_;
 };
@@ -105,15 +204,44 @@ constexpr uint64_t kCodeBase  = 0x00100000;
 constexpr uint64_t kCodeSize  = 0x00100000; // 1MB
 constexpr uint64_t kStackBase = 0x00201000;
 constexpr uint64_t kStackSize = 0x00002000;
+constexpr uint64_t kRingBase  = 0x00204000;
+constexpr uint64_t kRingSize  = 0x00001000;
+static_assert(sizeof(Ring) <= kRingSize);
+constexpr uint64_t kMailboxLockBase = 0x00205000;
+constexpr uint64_t kMailboxLockSize = 0x00001000;
+constexpr uint64_t kRingPoolBase = 0x00300000;
+constexpr uint32_t kMaxInferiors = 16;
+constexpr uint32_t kMaxCryptoThreads = 16;
+constexpr uint32_t kMaxSpin = 1000;
+// offsets in the CSRs
+constexpr uint64_t kCsrCmdqAddr = 0x10;
+constexpr uint64_t kCsrRspqAddr = 0x18;
+constexpr uint64_t kCsrCmdqSize = 0x20;
+constexpr uint64_t kCsrRspqSize = 0x28;
+constexpr uint64_t kCsrCmdHead = 0x48;
+constexpr uint64_t kCsrCmdTail = 0x50;
+constexpr uint64_t kCsrRspTail = 0x60;
+constexpr uint64_t kCsrKeySlots = 0x68;
 
 MemoryRegion CSR(kCsrFd, kCsrBase);
 MemoryRegion DRAM(kDramFd, kDramBase);
 MemoryRegion Code(kCodeBase, kCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC);
 MemoryRegion Stack(kStackBase, kStackSize, PROT_READ | PROT_WRITE);
+// Shared with the firmware processes, unlike the regions above. Each of them sees its own ring at
+// kRingBase, see MapRing().
+MemoryRegion RingPool(kRingPoolBase, kMaxInferiors * kRingSize, PROT_READ | PROT_WRITE, MAP_SHARED);
+// Taken by the firmware processes around the mailbox queues. Zeroed whenever none of them runs,
+// so one killed while holding it doesn't block the next ones.
+MemoryRegion MailboxLock(kMailboxLockBase, kMailboxLockSize, PROT_READ | PROT_WRITE, MAP_SHARED);
 
 int flag_firmware;
 int flag_sandbox;
 
+// Accumulated over all commands, see Inferior::copyStats() for the per-command split.
+CopyStats copy_totals;
+// Crypto buffers used directly from DRAM, without any copy.
+uint64_t in_place_buffers;
+
 enum chaos_request_algo {
   /* copy input to output, for testing purpose */
   CHAOS_ALGO_ECHO,
@@ -129,14 +257,95 @@ enum chaos_request_algo {
   CHAOS_ALGO_TF_DEC,
   CHAOS_ALGO_FFF_ENC,
   CHAOS_ALGO_FFF_DEC,
+  // key slots, the slot is the key handle argument
+  CHAOS_ALGO_LOAD_SLOT = 251,
+  CHAOS_ALGO_DESTROY_SLOT = 252,
   CHAOS_ALGO_REG_KEY = 254,
   CHAOS_ALGO_UNREG_KEY = 255,
 };
 
-std::map<uint32_t, Buffer *>key_map;
-long RegisterKey(Buffer *buf) {
+// A key with the schedules of the block ciphers it is used with, each expanded by the first call of
+// its cipher and reused by the later ones. Calls share a schedule rather than copy it, so that
+// offloaded ones keep it past the key's unregistration.
+struct Key {
+  Buffer bytes;
+  // Blowfish converts the bytes in place on each use, see crypto::BLOWFISH_setkey(), and every
+  // algorithm sees them as left by the last one. Schedules are kept for both states, indexed by
+  // whether the bytes are converted from how they were registered.
+  bool converted = false;
+  std::shared_ptr<const aes::Context> aes[2];
+  std::shared_ptr<const blowfish::Context> blowfish[2];
+  std::shared_ptr<const twofish::Context> twofish[2];
+  std::shared_ptr<const threefish::Context> threefish[2];
+};
+
+template <typename Context, typename SetKey>
+std::shared_ptr<const void> Expand(std::shared_ptr<const Context> &ctx, BufferView key,
+                                   SetKey setkey) {
+  if (!ctx) {
+    auto expanded = std::make_shared<Context>();
+    setkey(key, *expanded);
+    ctx = std::move(expanded);
+  }
+  return ctx;
+}
+
+// The schedule of @key for @algo's block cipher, converting the key if that is Blowfish. nullptr
+// for other algorithms.
+std::shared_ptr<const void> Schedule(Key &key, uint64_t algo) {
+  switch (algo) {
+  case CHAOS_ALGO_AES_ENC:
+  case CHAOS_ALGO_AES_DEC:
+    return Expand(key.aes[key.converted], key.bytes, crypto::AES_setkey);
+  case CHAOS_ALGO_BF_ENC:
+  case CHAOS_ALGO_BF_DEC:
+    blowfish::convert_key(key.bytes.ptr(), key.bytes.size());
+    key.converted = !key.converted;
+    return Expand(key.blowfish[key.converted], key.bytes,
+                  [](BufferView bytes, blowfish::Context &ctx) {
+      crypto::BLOWFISH_setkey(bytes, false, ctx);
+    });
+  case CHAOS_ALGO_TF_ENC:
+  case CHAOS_ALGO_TF_DEC:
+    return Expand(key.twofish[key.converted], key.bytes, crypto::TWOFISH_setkey);
+  case CHAOS_ALGO_FFF_ENC:
+  case CHAOS_ALGO_FFF_DEC:
+    return Expand(key.threefish[key.converted], key.bytes, crypto::THREEFISH_setkey);
+  default:
+    return nullptr;
+  }
+}
+
+// Schedule() of a key slot, whose bytes stay as loaded. Blowfish takes the conversion from the
+// handle instead, other algorithms ignore it.
+std::shared_ptr<const void> SlotSchedule(Key &key, uint64_t algo, bool converted) {
+  if (algo != CHAOS_ALGO_BF_ENC && algo != CHAOS_ALGO_BF_DEC)
+    return Schedule(key, algo);
+  return Expand(key.blowfish[converted], key.bytes,
+                [converted](BufferView bytes, blowfish::Context &ctx) {
+    crypto::BLOWFISH_setkey(bytes, converted, ctx);
+  });
+}
+
+using KeyMap = std::map<uint32_t, Key>;
+KeyMap key_map;
+// Nodes of unregistered keys, reused by RegisterKey() so the map stops allocating once warmed up.
+std::vector<KeyMap::node_type> spare_key_nodes;
+
+long RegisterKey(Key key) {
   static uint32_t count = 0;
-  key_map[++count] = buf;
+  ++count;
+  if (spare_key_nodes.empty()) {
+    key_map[count] = std::move(key);
+    return count;
+  }
+  KeyMap::node_type node = std::move(spare_key_nodes.back());
+  spare_key_nodes.pop_back();
+  node.key() = count;
+  node.mapped() = std::move(key);
+  auto res = key_map.insert(std::move(node));
+  if (!res.inserted)
+    res.position->second = std::move(res.node.mapped());
   return count;
 }
 
@@ -144,112 +353,507 @@ long UnRegisterKey(uint32_t h) {
   auto it = key_map.find(h);
   if (it == key_map.end())
     return 0;
-  Buffer *b = it->second;
-  key_map.erase(it);
-  delete b;
+  KeyMap::node_type node = key_map.extract(it);
+  node.mapped() = Key();
+  spare_key_nodes.push_back(std::move(node));
   return 0;
 }
 
-long HandleCryptoCall(Inferior &inferior, const uint64_t *args) {
-  if (args[0] == CHAOS_ALGO_REG_KEY) {
-    uint32_t key = args[1] >> 32, key_size = args[1];
-    Buffer *keyb = new Buffer(key_size);
-    if (key_size && !keyb->FromUser(inferior, key)) {
-      delete keyb;
-      return -EFAULT;
+// Keys the driver installs once for any number of requests, advertised in the CSRs. The firmware
+// passes a slot as key handle with kKeyHandleSlot set, keep in sync with its KEY_HANDLE_SLOT.
+// Blowfish leaves a slot's bytes as loaded, the firmware sets kKeyHandleConverted (its
+// KEY_HANDLE_CONVERTED) on the calls which see the key converted.
+constexpr uint32_t kNumKeySlots = 64;
+constexpr uint32_t kKeyHandleSlot = 0x80000000;
+constexpr uint32_t kKeyHandleConverted = 0x40000000;
+// longest key of any algorithm, RC4's
+constexpr uint32_t kMaxSlotKeySize = 256;
+// empty while free
+Key key_slots[kNumKeySlots];
+
+long LoadKeySlot(Inferior &inferior, uint32_t slot, uint32_t key, uint32_t key_size) {
+  if (slot >= kNumKeySlots || key_size == 0 || key_size > kMaxSlotKeySize)
+    return -EINVAL;
+  Buffer keyb(key_size);
+  if (!keyb.FromUser(inferior, key))
+    return -EFAULT;
+  key_slots[slot] = Key{ std::move(keyb) };
+  // both Blowfish schedules up front if it may be a Blowfish key, requests then only share them
+  if (key_size % sizeof(uint32_t) == 0 && key_size <= blowfish::kMaxKeyLength) {
+    SlotSchedule(key_slots[slot], CHAOS_ALGO_BF_ENC, false);
+    SlotSchedule(key_slots[slot], CHAOS_ALGO_BF_ENC, true);
+  }
+  return 0;
+}
+
+Key *FindKey(uint32_t handle) {
+  if (handle & kKeyHandleSlot) {
+    uint32_t slot = handle & ~(kKeyHandleSlot | kKeyHandleConverted);
+    if (slot >= kNumKeySlots || key_slots[slot].bytes.size() == 0)
+      return nullptr;
+    return &key_slots[slot];
+  }
+  auto it = key_map.find(handle);
+  return it == key_map.end() ? nullptr : &it->second;
+}
+
+// DRAM is mapped at the same address in the firmware, so buffers it passes from there can be used
+// in place. Returns nullptr if [uptr, uptr + size) is not entirely inside DRAM.
+uint8_t *DramAt(uint32_t uptr, uint32_t size) {
+  if (size == 0 || uptr < kDramBase || size > DRAM.size() || uptr - kDramBase > DRAM.size() - size)
+    return nullptr;
+  return static_cast<uint8_t *>(DRAM.at(uptr - kDramBase));
+}
+
+// Block ciphers always touch a whole block, only sizes they fully cover may use DRAM in place.
+uint32_t BlockSize(uint64_t algo) {
+  switch (algo) {
+  case CHAOS_ALGO_AES_ENC:
+  case CHAOS_ALGO_AES_DEC:
+    return aes::kBlockSize;
+  case CHAOS_ALGO_BF_ENC:
+  case CHAOS_ALGO_BF_DEC:
+    return blowfish::kBlockSize;
+  case CHAOS_ALGO_TF_ENC:
+  case CHAOS_ALGO_TF_DEC:
+    return twofish::kBlockSize;
+  case CHAOS_ALGO_FFF_ENC:
+  case CHAOS_ALGO_FFF_DEC:
+    return threefish::kBlockSize;
+  default:
+    return 1;
+  }
+}
+
+uint32_t OutputSize(uint64_t algo, uint32_t in_size) {
+  switch (algo) {
+  case CHAOS_ALGO_MD5:
+    return crypto::kMD5Length;
+  case CHAOS_ALGO_SHA256:
+    return crypto::kSHA256Length;
+  default:
+    return in_size;
+  }
+}
+
+// Index of @algo in the histograms of stats.
+uint32_t StatsAlgo(uint64_t algo) {
+  if (algo >= CHAOS_ALGO_LOAD_SLOT && algo <= CHAOS_ALGO_UNREG_KEY)
+    return stats::kAlgoKey;
+  return algo < stats::kAlgoKey ? algo : stats::kAlgoNone;
+}
+
+// @schedule is that of Schedule() for block ciphers, other algorithms taking a key get @keyb.
+long Compute(uint64_t algo, const Buffer *keyb, const void *schedule, BufferView inb,
+             Buffer &outb) {
+  switch (algo) {
+  case CHAOS_ALGO_MD5:
+    crypto::MD5(inb, outb);
+    break;
+  case CHAOS_ALGO_SHA256:
+    crypto::SHA256(inb, outb);
+    break;
+  case CHAOS_ALGO_AES_ENC:
+    crypto::AES_encrypt(*static_cast<const aes::Context *>(schedule), inb, outb);
+    break;
+  case CHAOS_ALGO_AES_DEC:
+    crypto::AES_decrypt(*static_cast<const aes::Context *>(schedule), inb, outb);
+    break;
+  case CHAOS_ALGO_RC4_ENC:
+    crypto::RC4_encrypt(*keyb, inb, outb);
+    break;
+  case CHAOS_ALGO_RC4_DEC:
+    crypto::RC4_decrypt(*keyb, inb, outb);
+    break;
+  case CHAOS_ALGO_BF_ENC:
+    crypto::BLOWFISH_encrypt(*static_cast<const blowfish::Context *>(schedule), inb, outb);
+    break;
+  case CHAOS_ALGO_BF_DEC:
+    crypto::BLOWFISH_decrypt(*static_cast<const blowfish::Context *>(schedule), inb, outb);
+    break;
+  case CHAOS_ALGO_TF_ENC:
+    crypto::TWOFISH_encrypt(*static_cast<const twofish::Context *>(schedule), inb, outb);
+    break;
+  case CHAOS_ALGO_TF_DEC:
+    crypto::TWOFISH_decrypt(*static_cast<const twofish::Context *>(schedule), inb, outb);
+    break;
+  case CHAOS_ALGO_FFF_ENC:
+    crypto::THREEFISH_encrypt(*static_cast<const threefish::Context *>(schedule), inb, outb);
+    break;
+  case CHAOS_ALGO_FFF_DEC:
+    crypto::THREEFISH_decrypt(*static_cast<const threefish::Context *>(schedule), inb, outb);
+    break;
+  default:
+    return -ENOSYS;
+  }
+  return outb.size();
+}
+
+// Calls from this cost on are worth the hand-off to the executor.
+constexpr uint32_t kOffloadMinCost = 0x1000;
+// Offloaded jobs of a vectored call are run in chunks of about this cost, a thread goes through a
+// chunk in one go with its data in the L1 cache. Calls up to this cost stay on a single thread.
+constexpr uint32_t kChunkCost = 0x8000;
+
+// Rough cost of a call, in bytes of input, whatever the algorithm. Key schedules are expanded
+// beforehand by PrepareCrypto(), once per key.
+uint32_t Cost(uint32_t in_size) {
+  return in_size;
+}
+
+inline bool WorthOffloading(uint32_t in_size) {
+  return Cost(in_size) >= kOffloadMinCost;
+}
+
+// Threads computing crypto calls, a Pool of num_crypto_threads or a Pipeline if use_pipeline.
+// None if they are computed by the dispatcher itself.
+uint32_t num_crypto_threads = 0;
+bool use_pipeline = false;
+// Compute with the portable cipher code even where the CPU has instructions for it, to compare
+// the two. Set with --portable-crypto.
+bool portable_crypto = false;
+std::unique_ptr<Executor> executor;
+// the executor as what it is
+Pool *pool;
+Pipeline *pipeline;
+
+struct Worker;
+
+// A crypto call split around Compute(), which touches nothing but the call's own buffers and DRAM
+// and so is what runs on the executor. Everything else involving the firmware or the key map stays
+// on the dispatcher, in the order the calls are made.
+class CryptoCall : public Task {
+ public:
+  void Run() override {
+    for (CryptoCall *call = this; call; call = call->chunk_next) {
+      uint64_t start = stats::Now();
+      call->ret = Compute(call->algo, call->keyb, call->schedule.get(), call->in_view, call->outb);
+      stats::RecordSince(stats::kCipher, StatsAlgo(call->algo), start);
+    }
+  }
+
+  // Only while the worker is held at the system call, the dispatcher then leaves it alone and
+  // can't reap it. Ring entries are copied out by the dispatcher, as the firmware may terminate
+  // meanwhile.
+  void CopyOut() override {
+    for (CryptoCall *call = this; call; call = call->chunk_next) {
+      if (!call->from_ring && call->ret >= 0 && call->outb.owned()) {
+        uint64_t start = stats::Now();
+        call->copied_out =
+            call->inferior->BulkWrite(call->outb.ptr(), call->out, call->outb.size());
+        PROBE(write, call->inferior->pid(), call->out, call->outb.size(), call->copied_out);
+        stats::RecordSince(stats::kCopyOut, StatsAlgo(call->algo), start);
+      }
     }
-    return RegisterKey(keyb);
   }
-  if (args[0] == CHAOS_ALGO_UNREG_KEY) {
+
+  void Clear() {
+    key = Buffer();
+    schedule.reset();
+    inb = Buffer();
+    outb = Buffer();
+    offloaded = false;
+    copied_out = false;
+    chunk_next = nullptr;
+  }
+
+  uint64_t algo;
+  // firmware address of the output
+  uint32_t out;
+  // the registered key, or a copy of it for offloaded calls as it may be unregistered meanwhile
+  const Buffer *keyb;
+  Buffer key;
+  // of the registered key, for block ciphers
+  std::shared_ptr<const void> schedule;
+  // owns the input only if it has to be copied out of the firmware
+  Buffer inb;
+  BufferView in_view;
+  Buffer outb;
+  long ret;
+  // handed to the executor and not completed yet
+  bool offloaded;
+  // The next call of the chunk it heads, computed along with it. Only calls heading a chunk are
+  // submitted to the executor.
+  CryptoCall *chunk_next;
+  // output written back by CopyOut()
+  bool copied_out;
+  // submitter, and whether it comes from its ring rather than the system call it is stopped at
+  Worker *worker;
+  const Inferior *inferior;
+  bool from_ring;
+  uint64_t user_data;
+};
+
+// Copies in what @call needs from the firmware and decides whether it is offloaded. Returns false
+// if there is nothing to compute, the result is then in call.ret already.
+bool PrepareCrypto(Inferior &inferior, const uint64_t *args, CryptoCall &call) {
+  const uint64_t algo = args[0];
+  call.algo = algo;
+  call.offloaded = false;
+  call.copied_out = false;
+  call.chunk_next = nullptr;
+  if (algo == CHAOS_ALGO_REG_KEY) {
+    uint32_t key = args[1] >> 32, key_size = args[1];
+    Buffer keyb(key_size);
+    if (key_size && !keyb.FromUser(inferior, key))
+      call.ret = -EFAULT;
+    else
+      call.ret = RegisterKey(Key{ std::move(keyb) });
+    return false;
+  }
+  if (algo == CHAOS_ALGO_UNREG_KEY) {
     uint32_t handler = args[1];
-    return UnRegisterKey(handler);
+    call.ret = UnRegisterKey(handler);
+    return false;
+  }
+  if (algo == CHAOS_ALGO_LOAD_SLOT) {
+    call.ret = LoadKeySlot(inferior, args[3], args[1] >> 32, args[1]);
+    return false;
+  }
+  if (algo == CHAOS_ALGO_DESTROY_SLOT) {
+    if (args[3] >= kNumKeySlots) {
+      call.ret = -EINVAL;
+    } else {
+      key_slots[args[3]] = Key();
+      call.ret = 0;
+    }
+    return false;
   }
   uint32_t in = args[1] >> 32;
   uint32_t in_size = args[1];
   uint32_t out = args[2] >> 32;
-  Buffer inb(in_size);
-  if (!inb.FromUser(inferior, in))
-    return -EFAULT;
-  if (args[0] == CHAOS_ALGO_MD5) {
-    Buffer outb(crypto::MD5(inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  if (args[0] == CHAOS_ALGO_SHA256) {
-    Buffer outb(crypto::SHA256(inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  uint32_t key_handle = args[3];
-  auto it = key_map.find(key_handle);
-  if (it == key_map.end())
+  uint32_t out_size = OutputSize(algo, in_size);
+  bool whole_blocks = in_size % BlockSize(algo) == 0;
+  uint8_t *in_dram = whole_blocks ? DramAt(in, in_size) : nullptr;
+  uint8_t *out_dram = whole_blocks ? DramAt(out, out_size) : nullptr;
+  // a partially overlapping output would clobber input not consumed yet
+  if (in_dram && out_dram && in_dram != out_dram &&
+      in_dram < out_dram + out_size && out_dram < in_dram + in_size)
+    in_dram = nullptr;
+
+  call.inb = Buffer(in_size);
+  call.in_view = BufferView(in_dram, in_size);
+  if (in_dram) {
+    in_place_buffers++;
+  } else if (!call.inb.FromUser(inferior, in)) {
+    call.ret = -EFAULT;
+    return false;
+  } else {
+    call.in_view = call.inb;
+  }
+  const bool offloaded = executor && WorthOffloading(in_size);
+  call.keyb = nullptr;
+  if (algo != CHAOS_ALGO_MD5 && algo != CHAOS_ALGO_SHA256) {
+    Key *key = FindKey(args[3]);
+    if (!key) {
+      call.ret = -EINVAL;
+      return false;
+    }
+    if (args[3] & kKeyHandleSlot)
+      call.schedule = SlotSchedule(*key, algo, args[3] & kKeyHandleConverted);
+    else
+      call.schedule = Schedule(*key, algo);
+    call.keyb = &key->bytes;
+    if (offloaded && !call.schedule) {
+      call.key = Buffer(key->bytes.ptr(), key->bytes.size());
+      call.keyb = &call.key;
+    }
+  }
+  call.out = out;
+  call.outb = Buffer(out_size);
+  if (out_dram) {
+    CHECK(call.outb.Borrow(out_dram));
+    in_place_buffers++;
+  } else {
+    CHECK(call.outb.Allocate());
+  }
+  call.offloaded = offloaded;
+  return true;
+}
+
+// Copies the output of a computed @call back unless it was written in place, and releases its
+// buffers. Returns the result of the call.
+long FinishCrypto(Inferior &inferior, CryptoCall &call) {
+  long ret = call.ret;
+  if (ret >= 0 && call.outb.owned() && !call.copied_out) {
+    uint64_t start = stats::Now();
+    if (!call.outb.ToUser(inferior, call.out))
+      ret = -EFAULT;
+    stats::RecordSince(stats::kCopyOut, StatsAlgo(call.algo), start);
+  }
+  PROBE(crypto_return, &call, call.algo, ret);
+  call.Clear();
+  return ret;
+}
+
+// Job descriptor of SYS_chaos_cryptov, keep in sync with the firmware's struct chaos_job. The
+// first four fields are the arguments of SYS_chaos_crypto, status receives its return value.
+struct CryptoJob {
+  uint64_t algo;
+  uint64_t in;
+  uint64_t out;
+  uint64_t key;
+  int64_t status;
+};
+
+constexpr uint32_t kMaxCryptoJobs = 64;
+// Calls of all workers which may be in the executor at once.
+constexpr uint32_t kMaxOffloaded = kMaxInferiors * (kMaxCryptoJobs + kRingEntries);
+
+// A firmware process serving the mailbox, up to num_inferiors of them run at once.
+struct Worker {
+  std::unique_ptr<Inferior> inferior;
+  // Its ring. The firmware can rewrite the whole ring at any time, so the sandbox keeps its own
+  // copy of the indices it advances and copies each entry out before using it.
+  Ring *ring;
+  uint32_t ring_sq_head;
+  uint32_t ring_cq_tail;
+  // waiting in SYS_chaos_wait for the next doorbell
+  bool parked;
+  // value of doorbells when it was last resumed
+  uint64_t doorbells;
+  // The crypto call or the jobs of the vectored call it is stopped at, and its ring entries by
+  // position in the submission ring.
+  CryptoCall calls[kMaxCryptoJobs];
+  CryptoJob jobs[kMaxCryptoJobs];
+  uint32_t num_jobs;
+  CryptoCall ring_calls[kRingEntries];
+  // Calls in the executor. The system call it is stopped at stays pending while calls of it are, as
+  // does SYS_chaos_submit with kSubmitWait (submit_wait) while ring entries are.
+  uint32_t pending;
+  uint32_t ring_pending;
+  bool submit_wait;
+  // when it was last resumed from a system call, 0 while it is stopped at one
+  uint64_t resumed_at;
+};
+
+// Prepares @call and either computes it, or returns true if it is to be handed to the executor.
+bool PrepareOrCompute(Worker &w, const uint64_t *args, CryptoCall &call, bool from_ring) {
+  PROBE(crypto_entry, &call, args[0], static_cast<uint32_t>(args[1]),
+        static_cast<uint32_t>(args[2]));
+  uint64_t start = stats::Now();
+  bool prepared = PrepareCrypto(*w.inferior, args, call);
+  stats::RecordSince(stats::kCopyIn, StatsAlgo(args[0]), start);
+  if (!prepared)
+    return false;
+  if (!call.offloaded) {
+    call.Run();
+    return false;
+  }
+  call.worker = &w;
+  call.from_ring = from_ring;
+  call.inferior = w.inferior.get();
+  return true;
+}
+
+// Prepares @call and either computes it, or hands it to the executor and returns true.
+bool StartCrypto(Worker &w, const uint64_t *args, CryptoCall &call, bool from_ring) {
+  if (!PrepareOrCompute(w, args, call, from_ring))
+    return false;
+  executor->Submit(&call);
+  return true;
+}
+
+// Starts the jobs of the SYS_chaos_cryptov call @w is stopped at, @args[1] of them from the array
+// at @args[0]. Returns an error, or 0 once they are started and FinishCryptoVec() is to be called
+// when none of them is pending anymore. The jobs may run concurrently, so no job may read what
+// another one writes, the job array included.
+long StartCryptoVec(Worker &w, const uint64_t *args) {
+  Inferior &inferior = *w.inferior;
+  uint32_t uptr = args[0];
+  uint32_t count = args[1];
+  if (count == 0 || count > kMaxCryptoJobs)
     return -EINVAL;
-  const Buffer *keyb = it->second;
-  switch (args[0]) {
-  case CHAOS_ALGO_AES_ENC: {
-    Buffer outb(crypto::AES_encrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_AES_DEC: {
-    Buffer outb(crypto::AES_decrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_RC4_ENC: {
-    Buffer outb(crypto::RC4_encrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_RC4_DEC: {
-    Buffer outb(crypto::RC4_decrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_BF_ENC: {
-    Buffer outb(crypto::BLOWFISH_encrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_BF_DEC: {
-    Buffer outb(crypto::BLOWFISH_decrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_TF_ENC: {
-    Buffer outb(crypto::TWOFISH_encrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_TF_DEC: {
-    Buffer outb(crypto::TWOFISH_decrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_FFF_ENC: {
-    Buffer outb(crypto::THREEFISH_encrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
-  }
-  case CHAOS_ALGO_FFF_DEC: {
-    Buffer outb(crypto::THREEFISH_decrypt(*keyb, inb));
-    if (!outb.ToUser(inferior, out))
-      return -EFAULT;
-    return outb.size();
+  if (!inferior.Read(reinterpret_cast<uint8_t *>(w.jobs), uptr, count * sizeof(CryptoJob)))
+    return -EFAULT;
+  w.num_jobs = count;
+  // the chunk being filled, submitted once it reaches kChunkCost or the jobs run out
+  CryptoCall *head = nullptr, *tail = nullptr;
+  uint32_t cost = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    CryptoJob &job = w.jobs[i];
+    CryptoCall &call = w.calls[i];
+    const uint64_t job_args[4] = { job.algo, job.in, job.out, job.key };
+    if (!PrepareOrCompute(w, job_args, call, false)) {
+      job.status = FinishCrypto(inferior, call);
+      continue;
+    }
+    uint32_t job_cost = Cost(call.in_view.size());
+    if (head && cost + job_cost > kChunkCost) {
+      executor->Submit(head);
+      w.pending++;
+      head = nullptr;
+    }
+    if (head) {
+      tail->chunk_next = &call;
+      cost += job_cost;
+    } else {
+      head = &call;
+      cost = job_cost;
+    }
+    tail = &call;
   }
-  default:
-    return -ENOSYS;
+  if (head) {
+    executor->Submit(head);
+    w.pending++;
+  }
+  return 0;
+}
+
+// Writes the job array back with the statuses of the jobs. Returns the number of jobs run.
+long FinishCryptoVec(Worker &w, const uint64_t *args) {
+  Inferior &inferior = *w.inferior;
+  for (uint32_t i = 0; i < w.num_jobs; i++) {
+    CryptoJob &job = w.jobs[i];
+    if (w.calls[i].offloaded)
+      job.status = FinishCrypto(inferior, w.calls[i]);
+    debug("job %u: algo %lu returned %ld\n", i, job.algo, job.status);
+  }
+  if (!inferior.Write(reinterpret_cast<uint8_t *>(w.jobs), args[0], w.num_jobs * sizeof(CryptoJob)))
+    return -EFAULT;
+  return w.num_jobs;
+}
+
+void ResetRing(Worker &w) {
+  memset(w.ring, 0, sizeof(*w.ring));
+  w.ring_sq_head = w.ring_cq_tail = 0;
+}
+
+void PostCompletion(Worker &w, CryptoCall &call) {
+  Ring *ring = w.ring;
+  long res = FinishCrypto(*w.inferior, call);
+  debug("ring: algo %lu returned %ld\n", call.algo, res);
+  ring->cq[w.ring_cq_tail % kRingEntries] = { call.user_data, res };
+  __atomic_store_n(&ring->cq_tail, ++w.ring_cq_tail, __ATOMIC_RELEASE);
+}
+
+// Takes everything in the submission ring. Entries computed inline complete right away, offloaded
+// ones once they are reaped. Stops early only if the firmware doesn't reap completions, then the
+// remaining entries wait for the next SYS_chaos_submit.
+void DrainRing(Worker &w) {
+  Ring *ring = w.ring;
+  while (1) {
+    uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    for (; w.ring_sq_head != tail; w.ring_sq_head++) {
+      uint32_t reserved = w.ring_cq_tail + w.ring_pending;
+      if (reserved - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >= kRingEntries)
+        return;
+      RingSqe sqe = ring->sq[w.ring_sq_head % kRingEntries];
+      const uint64_t args[4] = { sqe.algo, sqe.in, sqe.out, sqe.key };
+      // entries in flight are less than kRingEntries apart, their slots don't collide
+      CryptoCall &call = w.ring_calls[w.ring_sq_head % kRingEntries];
+      call.user_data = sqe.user_data;
+      if (StartCrypto(w, args, call, true))
+        w.ring_pending++;
+      else
+        PostCompletion(w, call);
+      __atomic_store_n(&ring->sq_head, w.ring_sq_head + 1, __ATOMIC_RELEASE);
+    }
+    // Pairs with the fence in the firmware's chaos_submit(): either the firmware sees the ring
+    // empty and rings SYS_chaos_submit, or a tail published meanwhile is seen here.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE) == w.ring_sq_head)
+      return;
   }
 }
 
@@ -264,38 +868,360 @@ long HandleFlagCall(Inferior &inferior, const uint64_t *args) {
   return ret;
 }
 
-bool Sandboxing() {
-  pid_t pid = fork();
-  if (!pid) {
-    ptrace(PTRACE_TRACEME, 0, 0, 0);
-    raise(SIGSTOP);
-    // shouldn't reach here
-    _exit(3);
-  }
+enum class RunResult {
+  kRunning, // busy, only returned by Run(w, false)
+  kParked, // waiting in SYS_chaos_wait for the next doorbell
+  kExited, // exited with 0, i.e. firmware handling one command per process
+  kFailed, // crashed or exited with an error
+};
+
+uint32_t num_inferiors = 1;
+Worker workers[kMaxInferiors];
+// Doorbells received so far.
+uint64_t doorbells;
 
-  Inferior inferior(pid);
-  inferior.Attach();
-  inferior.SetContext(Code.base(), Stack.end());
+// Serves the system calls of @w until it parks or terminates. Returns kRunning if it waits for
+// the executor, or unless @block as soon as it runs without a pending system call. Doesn't block
+// while ring entries of it are in the executor either, the firmware may be polling for them.
+RunResult Run(Worker &w, bool block) {
+  Inferior &inferior = *w.inferior;
   while (1) {
-    if (inferior.WaitForSys()) {
-      if (inferior.IsSysCrpyto()) {
-        auto res = HandleCryptoCall(inferior, inferior.sysargs());
-        debug("HandleCryptoCall returned %ld\n", res);
-        inferior.SetSyscallRet(res);
-      } else if (inferior.IsSysFlag()) {
-        inferior.SetSyscallRet(HandleFlagCall(inferior, inferior.sysargs()));
-      } else if (inferior.IsExit()) {
-        debug("firmware exited with %ld\n", inferior.sysargs()[0]);
-        return inferior.sysargs()[0] == 0;
+    // called right after its system call is answered, if it stopped at one
+    if (!w.resumed_at)
+      w.resumed_at = stats::Now();
+    Inferior::Stop stop = inferior.Poll(block && !w.ring_pending);
+    if (stop == Inferior::Stop::kNone)
+      return RunResult::kRunning;
+    if (stop == Inferior::Stop::kTerminated) {
+      // only exits with the seccomp backend, which lets exit(2) through
+      int status = inferior.lastStatus();
+      if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        return RunResult::kExited;
+      debug("firmware terminated with 0x%x\n", status);
+      return RunResult::kFailed;
+    }
+    stats::RecordSince(stats::kTrap, stats::kAlgoNone, w.resumed_at);
+    w.resumed_at = 0;
+    if (inferior.IsSysCrpyto()) {
+      if (StartCrypto(w, inferior.sysargs(), w.calls[0], false)) {
+        w.pending = 1;
+        return RunResult::kRunning;
       }
-    } else {
-      debug("firmware crashed with 0x%x\n", inferior.lastStatus());
+      auto res = FinishCrypto(inferior, w.calls[0]);
+      debug("crypto call returned %ld\n", res);
+      inferior.SetSyscallRet(res);
+    } else if (inferior.IsSysCryptoVec()) {
+      long res = StartCryptoVec(w, inferior.sysargs());
+      if (res == 0 && w.pending)
+        return RunResult::kRunning;
+      inferior.SetSyscallRet(res < 0 ? res : FinishCryptoVec(w, inferior.sysargs()));
+    } else if (inferior.IsSysFlag()) {
+      inferior.SetSyscallRet(HandleFlagCall(inferior, inferior.sysargs()));
+    } else if (inferior.IsSysSubmit()) {
+      if (inferior.sysargs()[0] & kSubmitWait) {
+        DrainRing(w);
+        if (w.ring_pending) {
+          w.submit_wait = true;
+          return RunResult::kRunning;
+        }
+        inferior.SetSyscallRet(0);
+      } else {
+        inferior.SetSyscallRet(0);
+        inferior.Resume();
+        DrainRing(w);
+      }
+    } else if (inferior.IsSysWait()) {
+      // commands queued since it was resumed may have been missed, their doorbell found it busy
+      if (w.doorbells != doorbells) {
+        w.doorbells = doorbells;
+        inferior.SetSyscallRet(0);
+        continue;
+      }
+      return RunResult::kParked;
+    } else if (inferior.IsExit()) {
+      debug("firmware exited with %ld\n", inferior.sysargs()[0]);
+      return inferior.sysargs()[0] == 0 ? RunResult::kExited : RunResult::kFailed;
+    }
+  }
+}
+
+// How the firmware's system calls are trapped, chosen with --trap on startup.
+enum class Trap {
+  kPtrace,
+  kSeccomp,
+};
+
+Trap trap = Trap::kPtrace;
+
+// Makes the ring of workers[@i] visible at kRingBase, in the sandbox and so in the next child.
+void MapRing(uint32_t i) {
+  void *ring = mremap(RingPool.at(i * kRingSize), 0, kRingSize, MREMAP_MAYMOVE | MREMAP_FIXED,
+                      reinterpret_cast<void *>(kRingBase));
+  CHECK(ring == reinterpret_cast<void *>(kRingBase));
+}
+
+// Runtime tuning, set with --sandbox-cpus, --firmware-cpus, --sched and --mlock.
+// CPUs the sandbox and its threads run on, all if empty.
+std::vector<int> sandbox_cpus;
+// CPUs the firmware processes are pinned to, workers[i] to the i-th one modulo their count.
+std::vector<int> firmware_cpus;
+enum class Sched {
+  kDefault,
+  kFifo, // SCHED_FIFO at sched_value
+  kNice, // SCHED_OTHER at nice value sched_value
+};
+Sched sched = Sched::kDefault;
+int sched_value;
+// Fault in and lock the memory the firmware touches, in the sandbox and in each firmware process
+// as locks and page tables of shared mappings are not inherited.
+bool lock_memory;
+
+// Parses a CPU list such as "0-3,6" into @cpus. Returns false if it is malformed.
+bool ParseCpus(const char *list, std::vector<int> &cpus) {
+  cpus.clear();
+  while (*list) {
+    char *end;
+    long first = strtol(list, &end, 10), last = first;
+    if (end == list)
       return false;
+    if (*end == '-') {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if (end == list)
+        return false;
     }
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+    for (long cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+    if (*end == ',')
+      end++;
+    else if (*end)
+      return false;
+    list = end;
   }
+  return !cpus.empty();
+}
+
+bool PinTo(const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus)
+    CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+void LockMemory() {
+  CSR.Lock();
+  DRAM.Lock();
+  Code.Lock();
+  Stack.Lock();
+  RingPool.Lock();
+  MailboxLock.Lock();
+}
+
+// Applies the tuning to the sandbox, before its threads are created so they inherit it.
+void Tune() {
+  if (!sandbox_cpus.empty())
+    CHECK(PinTo(sandbox_cpus));
+  if (sched == Sched::kFifo) {
+    struct sched_param param = {};
+    param.sched_priority = sched_value;
+    CHECK(sched_setscheduler(0, SCHED_FIFO, &param) == 0);
+  } else if (sched == Sched::kNice) {
+    CHECK(setpriority(PRIO_PROCESS, 0, sched_value) == 0);
+  }
+  if (lock_memory)
+    LockMemory();
+}
+
+// Keeps the scheduling policy of Tune() from the firmware processes, once the threads of the
+// sandbox have inherited it. They get SCHED_OTHER at nice 0 or above when forked.
+void ResetSchedOnFork() {
+  if (sched == Sched::kDefault)
+    return;
+  struct sched_param param = {};
+  param.sched_priority = sched == Sched::kFifo ? sched_value : 0;
+  int policy = sched == Sched::kFifo ? SCHED_FIFO : SCHED_OTHER;
+  CHECK(sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param) == 0);
+}
+
+// Runs in the firmware process for workers[@i] before it starts.
+bool SetupFirmware(uint32_t i) {
+  if (!firmware_cpus.empty() && !PinTo({ firmware_cpus[i % firmware_cpus.size()] }))
+    return false;
+  if (lock_memory) {
+    LockMemory();
+    // its ring
+    if (mlock(reinterpret_cast<void *>(kRingBase), kRingSize) != 0)
+      return false;
+  }
+  return true;
+}
+
+std::unique_ptr<Inferior> SpawnFirmware(uint32_t i) {
+  auto setup = [i] { return SetupFirmware(i); };
+  if (trap == Trap::kSeccomp)
+    return SeccompInferior::Spawn(Code.base(), Stack.end(), setup);
+  return PtraceInferior::Spawn(Code.base(), Stack.end(), setup);
+}
+
+// epoll tags besides the worker indices
+constexpr uint32_t kTagDoorbell = kMaxInferiors;
+constexpr uint32_t kTagChild = kMaxInferiors + 1;
+constexpr uint32_t kTagExecutor = kMaxInferiors + 2;
+
+void Watch(int epfd, int fd, uint32_t tag) {
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+}
+
+void Spawn(int epfd, uint32_t i) {
+  Worker &w = workers[i];
+  w.ring = static_cast<Ring *>(RingPool.at(i * kRingSize));
+  ResetRing(w);
+  MapRing(i);
+  uint64_t start = stats::Now();
+  w.inferior = SpawnFirmware(i);
+  stats::RecordSince(stats::kSpawn, stats::kAlgoNone, start);
+  PROBE(spawn, i, w.inferior->pid());
+  w.resumed_at = 0;
+  // closing the fd with the inferior removes it from epfd
+  if (w.inferior->fd() >= 0)
+    Watch(epfd, w.inferior->fd(), i);
+}
+
+// Set once a worker parks or exits, the host is then signaled if there are new responses.
+bool settled;
+
+// A worker lives across doorbells as long as it parks in SYS_chaos_wait, otherwise a new one is
+// spawned on the next doorbell.
+void Settle(Worker &w, RunResult res) {
+  if (res == RunResult::kRunning)
+    return;
+  const CopyStats &stats = w.inferior->copyStats();
+  copy_totals.bulk += stats.bulk;
+  copy_totals.ptrace += stats.ptrace;
+  debug("copies: bulk %lu ptrace %lu\n", stats.bulk, stats.ptrace);
+  stats::Set(stats::kCopyBulk, copy_totals.bulk);
+  stats::Set(stats::kCopyPtrace, copy_totals.ptrace);
+  stats::Set(stats::kInPlaceBuffers, in_place_buffers);
+  stats::Set(stats::kSpinHits, spin.stats().hits);
+  stats::Set(stats::kSpinMisses, spin.stats().misses);
+  stats::Set(stats::kSpinBlocking, spin.stats().blocking);
+  stats::Set(stats::kSpinBudget, spin.stats().budget);
+  stats::Set(stats::kArenaAllocs, arena::stats().allocs);
+  stats::Set(stats::kArenaSystem, arena::stats().system);
+  stats::Set(stats::kArenaReturned, arena::stats().returned);
+  if (pool)
+    stats::Set(stats::kPoolSteals, pool->steals());
+  for (int stage = Pipeline::kCompute; pipeline && stage < Pipeline::kNumStages; stage++) {
+    StageStats st = pipeline->stats(static_cast<Pipeline::Stage>(stage));
+    uint32_t base = stats::kComputeTasks + stage * stats::kStageCounters;
+    stats::Set(static_cast<stats::Counter>(base), st.tasks);
+    stats::Set(static_cast<stats::Counter>(base + 1), st.occupancy);
+    stats::Set(static_cast<stats::Counter>(base + 2), st.max_occupancy);
+  }
+  w.inferior->clearCopyStats();
+  if (res == RunResult::kParked) {
+    w.parked = true;
+  } else {
+    PROBE(exit, &w - workers, w.inferior->pid(), res == RunResult::kFailed);
+    // its calls still in the executor are dropped once reaped, see Complete()
+    w.inferior.reset();
+    w.submit_wait = false;
+  }
+  if (res != RunResult::kFailed)
+    settled = true;
+}
+
+inline bool Busy(const Worker &w) {
+  return w.inferior && !w.parked;
+}
+
+// Stopped at a system call which completes with calls of it in the executor, it must not be run.
+inline bool Held(const Worker &w) {
+  return w.pending || w.submit_wait;
+}
+
+// Terminated with calls in the executor, whose storage it can't reuse before they are reaped.
+inline bool Draining(const Worker &w) {
+  return !w.inferior && (w.pending || w.ring_pending);
+}
+
+// Resumes parked workers, or spawns them, one per command waiting to be claimed but at least one.
+// Workers still busy claim new commands by themselves.
+void Wake(int epfd) {
+  bool busy = false;
+  for (uint32_t i = 0; i < num_inferiors; i++)
+    busy |= Busy(workers[i]);
+  if (!busy)
+    memset(MailboxLock.base(), 0, MailboxLock.size());
+  uint64_t cmdq_size = CSR.Read64(kCsrCmdqSize);
+  uint64_t pending = (CSR.Read64(kCsrCmdTail) - CSR.Read64(kCsrCmdHead)) & ((cmdq_size << 1) - 1);
+  if (pending == 0)
+    pending = 1;
+  for (uint32_t i = 0; i < num_inferiors && pending; i++) {
+    Worker &w = workers[i];
+    if (Busy(w) || Draining(w))
+      continue;
+    if (w.inferior) {
+      w.inferior->SetSyscallRet(0);
+      w.parked = false;
+    } else {
+      Spawn(epfd, i);
+    }
+    w.doorbells = doorbells;
+    pending--;
+    // Resumes it. A single worker runs until it parks or waits for the executor, nothing else can
+    // happen meanwhile.
+    Settle(w, Run(w, num_inferiors == 1));
+  }
+}
+
+// Takes back a call computed by the executor along with the rest of its chunk, and resumes its
+// worker if it was the last one its system call waited for.
+void Complete(int epfd, CryptoCall &call) {
+  Worker &w = *call.worker;
+  if (call.from_ring)
+    w.ring_pending--;
+  else
+    w.pending--;
+  if (!w.inferior) {
+    for (CryptoCall *next, *c = &call; c; c = next) {
+      next = c->chunk_next;
+      c->Clear();
+    }
+    // doorbells which found it draining may have had nobody else to wake
+    if (!Draining(w) && w.doorbells != doorbells)
+      Wake(epfd);
+    return;
+  }
+  Inferior &inferior = *w.inferior;
+  if (call.from_ring) {
+    PostCompletion(w, call);
+    // the entries left behind for lack of completion slots fit now
+    DrainRing(w);
+    if (!w.submit_wait || w.ring_pending)
+      return;
+    w.submit_wait = false;
+    inferior.SetSyscallRet(0);
+  } else if (w.pending) {
+    return;
+  } else if (inferior.IsSysCrpyto()) {
+    auto res = FinishCrypto(inferior, call);
+    debug("crypto call returned %ld\n", res);
+    inferior.SetSyscallRet(res);
+  } else {
+    inferior.SetSyscallRet(FinishCryptoVec(w, inferior.sysargs()));
+  }
+  Settle(w, Run(w, num_inferiors == 1));
 }
 
 void VerifyResult(int res) {
+  PROBE(verify_return, res);
   CSR.Write64(0, (1ull << 63) | res);
 }
 
@@ -313,9 +1239,70 @@ constexpr uint8_t kSignKey[kSignKeyLength] = {
   0x0f,0xff,0x0e,0xe9,0x45,0xbd,0x41,0x76,0xf5,0x5a,0x40,0x54,0x3b,0x36,0x66,0x84,0x3a,0x0d,0x56,0x5c,0x33,0x9e,0x5d,0x89,0x69,0xfc,0xd7,0xca,0x92,0x1c,0xc3,0x03,0xa1,0xc8,0xaf,0x16,0x24,0x0c,0x4d,0x03,0x2d,0x19,0x31,0x63,0x2b,0x90,0x99,0x6d,0xd4,0x8a,0xeb,0xac,0xee,0x30,0x7d,0x3c,0x57,0xbc,0x83,0x37,0x56,0x98,0xae,0x7d,0xf9,0x0d,0x10,0x16,0x3e,0xde,0xe9,0xe0,0x67,0xce,0x46,0xe7,0x38,0x09,0x22,0x57,0xda,0xfb,0x15,0xb8,0x0f,0xb6,0x59,0x61,0x90,0x0d,0xef,0xfa,0x9b,0x59,0xb5,0x7e,0x47,0x2b,0xf5,0x6b,0xe0,0xd9,0xf6,0x48,0xad,0x69,0x08,0xf2,0x55,0x3b,0xe1,0x3a,0x9e,0xa0,0xcd,0xa2,0x43,0x17,0x75,0x6c,0xba,0x51,0x42,0xa9,0x5e,0x21,0xf9,0xe0
 };
 
+// Digests of images verified before, by this and other instances sharing the file given with
+// --verify-cache. Whoever can write the file can have any image accepted, it must only be shared
+// by instances trusting each other.
+int verify_cache = -1;
+std::set<std::string> verified_images;
+const char *verify_cache_path;
+
+constexpr uint32_t kDigestLength = crypto::kSHA256Length;
+
+// Reads the digests in the cache file at @path, created if missing. Done before the seccomp filter
+// is installed, only appending to the file is possible afterwards.
+void LoadVerifyCache(const char *path) {
+  verify_cache = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  CHECK(verify_cache >= 0);
+  char digest[kDigestLength];
+  // a record cut short by a crashed writer is dropped along with anything after it
+  while (read(verify_cache, digest, sizeof(digest)) == sizeof(digest))
+    verified_images.emplace(digest, sizeof(digest));
+}
+
+// What the verification of an image depends on: its header and the hash of its code.
+std::string ImageDigest(const ImageHeader &header, BufferView hsh) {
+  Buffer inb(sizeof(header) + hsh.size());
+  CHECK(inb.Allocate());
+  memcpy(inb.ptr(), &header, sizeof(header));
+  memcpy(inb.ptr() + sizeof(header), hsh.ptr(), hsh.size());
+  Buffer digest(crypto::SHA256(inb));
+  return std::string(reinterpret_cast<const char *>(digest.ptr()), digest.size());
+}
+
+// Checks the signature in @header over @code. Returns 0 if it is valid.
+int VerifyImage(const ImageHeader &header, BufferView code) {
+  Buffer hsh(crypto::SHA256(code));
+  std::string digest;
+  if (verify_cache >= 0) {
+    digest = ImageDigest(header, hsh);
+    if (verified_images.count(digest)) {
+      debug("firmware of %u bytes found in the verify cache\n", code.size());
+      return 0;
+    }
+  }
+  Buffer N(header.key, header.key_size);
+  // BUG: header.key_size can be longer than kSignKeyLength
+  // -> key for decryption is longer than the constexpr one
+  if (memcmp(N.ptr(), kSignKey, kSignKeyLength))
+    return -EKEYREJECTED;
+  Buffer sign(header.signature, header.key_size);
+  uint32_t e = 0x10001;
+  Buffer E((const uint8_t *)&e, sizeof(e));
+  Buffer res(crypto::RSA_encrypt(N, E, sign));
+  if (!BufferView(hsh).ValueEq(res))
+    return -EBADMSG;
+  if (verify_cache >= 0) {
+    // appends of a single record don't interleave with other instances'
+    CHECK(write(verify_cache, digest.data(), digest.size()) == (ssize_t)digest.size());
+    verified_images.insert(digest);
+  }
+  return 0;
+}
+
 void VerifyFirmware() {
   uint32_t off = CSR.Read64(0);
   uint32_t size = CSR.Read64(8);
+  PROBE(verify_entry, size);
   ImageHeader *image = reinterpret_cast<ImageHeader*>(DRAM.at(off));
   ImageHeader header;
 
@@ -324,45 +1311,284 @@ void VerifyFirmware() {
   header = *image;
   if (header.size + sizeof(header) != size || header.size > Code.size())
     return VerifyResult(-EINVAL);
-  Buffer inb(image->code, header.size);
-  Buffer hsh(crypto::SHA256(inb));
-  Buffer N(image->key, header.key_size);
-  // BUG: header.key_size can be longer than kSignKeyLength
-  // -> key for decryption is longer than the constexpr one
-  if (memcmp(N.ptr(), kSignKey, kSignKeyLength))
-    return VerifyResult(-EKEYREJECTED);
-  Buffer sign(image->signature, header.key_size);
-  uint32_t e = 0x10001;
-  Buffer E((const uint8_t *)&e, sizeof(e));
-  Buffer res(crypto::RSA_encrypt(N, E, sign));
-  if (!hsh.ValueEq(res))
-    return VerifyResult(-EBADMSG);
-  memcpy(Code.at(0), inb.ptr(), inb.size());
-  VerifyResult(0);
+  // Copied once, straight to where it runs. Out of the guest's reach there, so what is verified is
+  // what runs.
+  uint8_t *code = static_cast<uint8_t *>(Code.at(0));
+  memcpy(code, image->code, header.size);
+  int res = VerifyImage(header, BufferView(code, header.size));
+  if (res)
+    memset(code, 0, header.size);
+  VerifyResult(res);
+}
+
+// DRAM at @off as the device addresses it. Returns nullptr if [off, off + size) is not entirely
+// inside DRAM.
+const uint8_t *DramOffset(uint64_t off, uint64_t size) {
+  if (size > DRAM.size() || off > DRAM.size() - size)
+    return nullptr;
+  return static_cast<const uint8_t *>(DRAM.base()) + off;
+}
+
+const char *capture_path;
+bool capture_inputs;
+// how far the queues have been captured
+uint64_t captured_cmd_tail, captured_rsp_tail;
+
+// Calls @fn on each entry of the queue from index @from up to @tail, at most a queue's worth. The
+// queue belongs to the guest, nothing outside DRAM is read.
+template <typename Entry, typename Fn>
+uint64_t ForEachQueued(uint64_t csr_addr, uint64_t csr_size, uint64_t from, uint64_t tail, Fn fn) {
+  uint64_t size = CSR.Read64(csr_size);
+  if (size == 0 || size > DRAM.size())
+    return tail;
+  const Entry *queue =
+      reinterpret_cast<const Entry *>(DramOffset(CSR.Read64(csr_addr), size * sizeof(Entry)));
+  if (!queue)
+    return tail;
+  for (uint64_t n = 0; from != tail && n < size; n++) {
+    fn(queue[from % size]);
+    from = (from + 1) & ((size << 1) - 1);
+  }
+  return tail;
+}
+
+void CaptureCommand(const MailboxCmd &cmd, uint64_t now) {
+  if (cmd.code != kCmdCodeRequest || cmd.dma_size != sizeof(Request))
+    return;
+  const uint8_t *ptr = DramOffset(cmd.dma_addr, sizeof(Request));
+  if (!ptr)
+    return;
+  Request req;
+  memcpy(&req, ptr, sizeof(req));
+  const uint8_t *input = capture_inputs ? DramOffset(req.input, req.in_size) : nullptr;
+  uint8_t flags = req.input == req.output ? capture::kInPlace : 0;
+  if (req.algo & kRequestKeySlot) {
+    flags |= capture::kKeySlot;
+    req.algo &= ~kRequestKeySlot;
+    req.key_size = req.key < kNumKeySlots ? key_slots[req.key].bytes.size() : 0;
+  }
+  capture::Command command = {
+    capture::kCommand, flags, cmd.seq,
+    req.algo, now, req.in_size, req.key_size, req.out_size, input ? req.in_size : 0,
+  };
+  capture::AddCommand(command, input);
+}
+
+// Brings the capture up to date with the queues. Commands go first: a busy worker may claim and
+// answer one before its doorbell is served.
+void Capture() {
+  uint64_t now = capture::Now();
+  captured_cmd_tail = ForEachQueued<MailboxCmd>(
+      kCsrCmdqAddr, kCsrCmdqSize, captured_cmd_tail, CSR.Read64(kCsrCmdTail),
+      [now](const MailboxCmd &cmd) { CaptureCommand(cmd, now); });
+  captured_rsp_tail = ForEachQueued<MailboxRsp>(
+      kCsrRspqAddr, kCsrRspqSize, captured_rsp_tail, CSR.Read64(kCsrRspTail),
+      [](const MailboxRsp &rsp) { capture::AddResponse(rsp.seq, rsp.retval); });
+  capture::Flush();
+}
+
+// Serves doorbells and the workers' system calls as they come. The workers claim commands from
+// the mailbox by themselves and answer them in completion order.
+[[noreturn]] void Dispatch(const Event &from, const Event &to) {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  CHECK(epfd >= 0);
+  Watch(epfd, from.fd(), kTagDoorbell);
+  // ptrace stops are only announced by SIGCHLD
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  CHECK(sigprocmask(SIG_BLOCK, &mask, nullptr) == 0);
+  int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  CHECK(sigfd >= 0);
+  Watch(epfd, sigfd, kTagChild);
+  if (executor)
+    Watch(epfd, executor->fd(), kTagExecutor);
+
+  uint64_t rsp_tail = CSR.Read64(kCsrRspTail);
+  struct epoll_event events[kMaxInferiors + 3];
+  // when the oldest doorbell not answered yet came, 0 if none
+  uint64_t doorbell_at = 0;
+  while (1) {
+    int n;
+    uint64_t start = stats::Now();
+    if (!spin.Spin([&] { return (n = epoll_wait(epfd, events, kMaxInferiors + 3, 0)) > 0; }))
+      n = epoll_wait(epfd, events, kMaxInferiors + 3, -1);
+    stats::RecordSince(stats::kWait, stats::kAlgoNone, start);
+    if (n < 0 && errno == EINTR)
+      continue;
+    CHECK(n > 0);
+    for (int i = 0; i < n; i++) {
+      uint32_t tag = events[i].data.u32;
+      if (tag == kTagDoorbell) {
+        from.Clear();
+        doorbells++;
+        PROBE(doorbell, doorbells);
+        if (!doorbell_at)
+          doorbell_at = stats::Now();
+        if (capture::enabled())
+          Capture();
+        Wake(epfd);
+      } else if (tag == kTagChild) {
+        struct signalfd_siginfo info;
+        while (read(sigfd, &info, sizeof(info)) == sizeof(info));
+        for (uint32_t j = 0; j < num_inferiors; j++)
+          if (Busy(workers[j]) && !Held(workers[j]) && workers[j].inferior->fd() < 0)
+            Settle(workers[j], Run(workers[j], false));
+      } else if (tag == kTagExecutor) {
+        executor->Reap([epfd](Task *task) { Complete(epfd, *static_cast<CryptoCall *>(task)); });
+      } else if (workers[tag].inferior && !Held(workers[tag])) {
+        // parked ones only have something to report if they were killed
+        Settle(workers[tag], Run(workers[tag], false));
+      }
+    }
+    // the workers answer a whole batch before parking, signal only if they published anything
+    if (settled) {
+      settled = false;
+      if (CSR.Read64(kCsrRspTail) != rsp_tail) {
+        rsp_tail = CSR.Read64(kCsrRspTail);
+        // before the host may reuse what the commands pointed to
+        if (capture::enabled())
+          Capture();
+        to.Trigger();
+        if (doorbell_at) {
+          stats::RecordSince(stats::kResponse, stats::kAlgoNone, doorbell_at);
+          doorbell_at = 0;
+        }
+      }
+    }
+  }
 }
 
 void RunMain() {
   constexpr int kEventFdFromHost = 5;
   constexpr int kEventFdToHost = 6;
   Event from(kEventFdFromHost), to(kEventFdToHost);
+  // before anything else takes its fd number
+  stats::Init();
   flag_firmware = open("flag_firmware", O_RDONLY);
   flag_sandbox = open("flag_sandbox", O_RDONLY);
   CHECK(flag_firmware >= 0);
   CHECK(flag_sandbox >= 0);
+  if (verify_cache_path)
+    LoadVerifyCache(verify_cache_path);
+  if (capture_path)
+    capture::Open(capture_path, capture_inputs);
+  crypto::Init(portable_crypto);
+  Tune();
+  CSR.Write64(kCsrKeySlots, kNumKeySlots);
+  // created before the filter is installed, which is synced to their threads, so it need not allow
+  // what starting a thread takes
+  if (use_pipeline) {
+    auto p = std::make_unique<Pipeline>(kMaxOffloaded);
+    pipeline = p.get();
+    executor = std::move(p);
+  } else if (num_crypto_threads) {
+    auto p = std::make_unique<Pool>(num_crypto_threads);
+    pool = p.get();
+    executor = std::move(p);
+  }
+  ResetSchedOnFork();
   install_seccomp();
+  if (trap == Trap::kPtrace)
+    SeccompInferior::ForbidSpawn();
   from.WaitAndClear();
   VerifyFirmware();
   to.Trigger(0x1337);
-  while (1) {
-    from.WaitAndClear();
-    if (Sandboxing())
-      to.Trigger();
+  Dispatch(from, to);
+}
+
+void ParseOptions(int argc, char *argv[]) {
+  static const struct option long_options[] = {
+    { "trap", required_argument, nullptr, 't' },
+    { "inferiors", required_argument, nullptr, 'n' },
+    { "crypto-threads", required_argument, nullptr, 'c' },
+    { "pipeline", no_argument, nullptr, 'p' },
+    { "spin", required_argument, nullptr, 's' },
+    { "sandbox-cpus", required_argument, nullptr, 'S' },
+    { "firmware-cpus", required_argument, nullptr, 'F' },
+    { "sched", required_argument, nullptr, 'P' },
+    { "mlock", no_argument, nullptr, 'm' },
+    { "verify-cache", required_argument, nullptr, 'V' },
+    { "capture", required_argument, nullptr, 'C' },
+    { "capture-inputs", no_argument, nullptr, 'I' },
+    { "portable-crypto", no_argument, nullptr, 'A' },
+    { nullptr, 0, nullptr, 0 },
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "t:n:c:ps:S:F:P:mV:C:IA", long_options, nullptr)) != -1) {
+    switch (c) {
+    case 't':
+      if (!strcmp(optarg, "ptrace"))
+        trap = Trap::kPtrace;
+      else if (!strcmp(optarg, "seccomp"))
+        trap = Trap::kSeccomp;
+      else
+        CHECK(false);
+      break;
+    case 'n':
+      num_inferiors = atoi(optarg);
+      CHECK(1 <= num_inferiors && num_inferiors <= kMaxInferiors);
+      break;
+    case 'c':
+      num_crypto_threads = atoi(optarg);
+      CHECK(num_crypto_threads <= kMaxCryptoThreads);
+      break;
+    case 'p':
+      use_pipeline = true;
+      break;
+    case 's': {
+      // in microseconds
+      uint32_t max_spin = atoi(optarg);
+      CHECK(max_spin <= kMaxSpin);
+      spin.SetMaxBudget(max_spin * 1000ull);
+      break;
+    }
+    case 'S':
+      CHECK(ParseCpus(optarg, sandbox_cpus));
+      break;
+    case 'F':
+      CHECK(ParseCpus(optarg, firmware_cpus));
+      break;
+    case 'P':
+      // fifo:<priority> or nice:<value>
+      if (!strncmp(optarg, "fifo:", 5)) {
+        sched = Sched::kFifo;
+        sched_value = atoi(optarg + 5);
+        CHECK(sched_get_priority_min(SCHED_FIFO) <= sched_value &&
+              sched_value <= sched_get_priority_max(SCHED_FIFO));
+      } else if (!strncmp(optarg, "nice:", 5)) {
+        sched = Sched::kNice;
+        sched_value = atoi(optarg + 5);
+        CHECK(-20 <= sched_value && sched_value <= 19);
+      } else {
+        CHECK(false);
+      }
+      break;
+    case 'm':
+      lock_memory = true;
+      break;
+    case 'V':
+      verify_cache_path = optarg;
+      break;
+    case 'C':
+      capture_path = optarg;
+      break;
+    case 'I':
+      capture_inputs = true;
+      break;
+    case 'A':
+      portable_crypto = true;
+      break;
+    default:
+      CHECK(false);
+    }
   }
 }
 
 } // namespace
 
-int main() {
+int main(int argc, char *argv[]) {
+  ParseOptions(argc, argv);
   RunMain();
   return 0;
 }
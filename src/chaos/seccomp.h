@@ -1,5 +1,6 @@
 // gem install seccomp-tools
-// sed '/^#define/r'<(echo;seccomp-tools asm sandbox.bpf -f c_source) seccomp.h.tpl > seccomp.h
+// seccomp-tools asm sandbox.bpf -f c_source | sed -f tsync.sed > filter.c
+// sed '/^#define/r'<(echo;cat filter.c) seccomp.h.tpl > seccomp.h
 #ifndef _SECCOMP_H
 #define _SECCOMP_H
 
@@ -7,9 +8,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 static void install_seccomp() {
-  static unsigned char filter[] = {32,0,0,0,4,0,0,0,21,0,0,22,62,0,0,192,32,0,0,0,0,0,0,0,53,0,20,0,0,0,0,64,21,0,18,0,0,0,0,0,21,0,17,0,1,0,0,0,21,0,16,0,3,0,0,0,21,0,15,0,9,0,0,0,21,0,14,0,11,0,0,0,21,0,13,0,12,0,0,0,21,0,12,0,56,0,0,0,21,0,11,0,101,0,0,0,21,0,10,0,61,0,0,0,21,0,9,0,17,1,0,0,21,0,8,0,14,0,0,0,21,0,7,0,39,0,0,0,21,0,6,0,186,0,0,0,21,0,5,0,62,0,0,0,21,0,4,0,234,0,0,0,21,0,3,0,23,0,0,0,21,0,2,0,60,0,0,0,21,0,1,0,231,0,0,0,6,0,0,0,0,0,0,0,6,0,0,0,0,0,255,127,6,0,0,0,0,0,0,0};
+  static unsigned char filter[] = {32,0,0,0,4,0,0,0,21,0,0,59,62,0,0,192,32,0,0,0,0,0,0,0,53,0,57,0,0,0,0,64,21,0,55,0,0,0,0,0,21,0,54,0,1,0,0,0,21,0,53,0,3,0,0,0,21,0,52,0,9,0,0,0,21,0,51,0,11,0,0,0,21,0,50,0,12,0,0,0,21,0,49,0,56,0,0,0,21,0,48,0,101,0,0,0,21,0,47,0,61,0,0,0,21,0,46,0,17,1,0,0,21,0,45,0,14,0,0,0,21,0,44,0,39,0,0,0,21,0,43,0,110,0,0,0,21,0,42,0,186,0,0,0,21,0,41,0,62,0,0,0,21,0,40,0,234,0,0,0,21,0,39,0,7,0,0,0,21,0,38,0,54,1,0,0,21,0,37,0,55,1,0,0,21,0,36,0,53,0,0,0,21,0,35,0,46,0,0,0,21,0,34,0,47,0,0,0,21,0,33,0,61,1,0,0,21,0,32,0,178,1,0,0,21,0,31,0,35,1,0,0,21,0,30,0,233,0,0,0,21,0,29,0,232,0,0,0,21,0,28,0,25,0,0,0,21,0,27,0,247,0,0,0,21,0,26,0,33,1,0,0,21,0,25,0,202,0,0,0,21,0,20,0,10,0,0,0,21,0,21,0,28,0,0,0,21,0,22,0,149,0,0,0,21,0,21,0,203,0,0,0,21,0,20,0,78,1,0,0,21,0,19,0,228,0,0,0,21,0,18,0,5,138,12,0,21,0,17,0,252,137,12,0,21,0,16,0,6,138,12,0,21,0,15,0,7,138,12,0,21,0,14,0,8,138,12,0,21,0,4,0,16,0,0,0,21,0,6,0,157,0,0,0,21,0,11,0,60,0,0,0,21,0,10,0,231,0,0,0,6,0,0,0,0,0,0,0,32,0,0,0,24,0,0,0,21,0,7,0,0,33,80,192,21,0,6,7,1,33,24,192,32,0,0,0,16,0,0,0,21,0,4,5,1,0,0,0,32,0,0,0,32,0,0,0,69,0,3,2,4,0,0,0,32,0,0,0,32,0,0,0,21,0,0,1,4,0,0,0,6,0,0,0,0,0,255,127,6,0,0,0,0,0,0,0};
   struct prog {
     unsigned short len;
     unsigned char *filter;
@@ -18,7 +21,7 @@ static void install_seccomp() {
     .filter = filter
   };
   if(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) { perror("prctl(PR_SET_NO_NEW_PRIVS)"); exit(2); }
-  if(prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &rule) < 0) { perror("prctl(PR_SET_SECCOMP)"); exit(2); }
+  if(syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_TSYNC, &rule) != 0) { perror("seccomp(SECCOMP_FILTER_FLAG_TSYNC)"); exit(2); }
 }
 
 #endif // _SECCOMP_H
@@ -1,5 +1,6 @@
 // gem install seccomp-tools
-// sed '/^#define/r'<(echo;seccomp-tools asm sandbox.bpf -f c_source) seccomp.h.tpl > seccomp.h
+// seccomp-tools asm sandbox.bpf -f c_source | sed -f tsync.sed > filter.c
+// sed '/^#define/r'<(echo;cat filter.c) seccomp.h.tpl > seccomp.h
 #ifndef _SECCOMP_H
 #define _SECCOMP_H
 
@@ -0,0 +1,235 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#include "seccomp_inferior.h"
+
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+#include "check.h"
+
+namespace {
+
+// Runs in the child. The listener fd is handed to the parent through sock afterwards and both are
+// closed before entering the firmware, so the only real system calls left to it are exit and the
+// close of these two fds.
+int InstallFilter(int sock, int listener) {
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_chaos_crypto, 15, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_chaos_cryptov, 14, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_chaos_flag, 13, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_chaos_wait, 12, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_chaos_submit, 11, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_exit, 9, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_exit_group, 8, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_sendmsg, 1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_close, 2, 5),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, args[0])),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(sock), 4, 3),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, args[0])),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(sock), 2, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(listener), 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+  };
+  struct sock_fprog prog = {
+    .len = sizeof(filter) / sizeof(filter[0]),
+    .filter = filter,
+  };
+  // PR_SET_NO_NEW_PRIVS is inherited from the sandbox's own filter
+  return syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+}
+
+bool SendFd(int sock, int fd) {
+  char data = 0;
+  struct iovec iov = { &data, sizeof(data) };
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control = {};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  return sendmsg(sock, &msg, 0) == sizeof(data);
+}
+
+int RecvFd(int sock) {
+  char data;
+  struct iovec iov = { &data, sizeof(data) };
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(data))
+    return -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+    return -1;
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
+[[noreturn]] void Enter(void *pc, void *stk) {
+  asm volatile("mov %0, %%rsp\n\t"
+               "jmp *%1\n\t"
+               :: "r"(stk), "r"(pc) : "memory");
+  __builtin_unreachable();
+}
+
+} // namespace
+
+SeccompInferior::SeccompInferior(pid_t pid, int listener)
+    : Inferior(pid), listener_(listener), id_(0) {
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  CHECK(epfd_ >= 0);
+  // Edge triggered, the listener may report EPOLLHUP for a while after a notification is answered
+  // even though the child is alive. There is at most one notification in flight.
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = listener_;
+  CHECK(epoll_ctl(epfd_, EPOLL_CTL_ADD, listener_, &ev) == 0);
+  ev.events = EPOLLIN;
+  ev.data.fd = pidfd_;
+  CHECK(epoll_ctl(epfd_, EPOLL_CTL_ADD, pidfd_, &ev) == 0);
+}
+
+SeccompInferior::~SeccompInferior() {
+  close(epfd_);
+  close(listener_);
+}
+
+std::unique_ptr<Inferior> SeccompInferior::Spawn(void *pc, void *stk,
+                                                 const std::function<bool()> &setup) {
+  int sv[2];
+  CHECK(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sv) == 0);
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (!pid) {
+    // nothing else stops the firmware once the sandbox is gone, unlike PTRACE_O_EXITKILL
+    if (prctl(PR_SET_PDEATHSIG, SIGKILL) != 0 || getppid() != parent)
+      _exit(3);
+    close(sv[0]);
+    if (!setup())
+      _exit(3);
+    // the listener takes the lowest free fd, the one just closed
+    int listener = InstallFilter(sv[1], sv[0]);
+    if (listener != sv[0] || !SendFd(sv[1], listener))
+      _exit(3);
+    close(listener);
+    close(sv[1]);
+    Enter(pc, stk);
+  }
+  close(sv[1]);
+  // fails if the child exited instead of sending the listener
+  int listener = RecvFd(sv[0]);
+  close(sv[0]);
+  CHECK(pid > 0 && listener >= 0);
+  return std::make_unique<SeccompInferior>(pid, listener);
+}
+
+void SeccompInferior::ForbidSpawn() {
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_socketpair, 5, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_prctl, 4, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_sendmsg, 3, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_recvmsg, 2, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_seccomp, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+  };
+  struct sock_fprog prog = {
+    .len = sizeof(filter) / sizeof(filter[0]),
+    .filter = filter,
+  };
+  // the arch is already checked by the sandbox's own filter
+  CHECK(syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_TSYNC, &prog) == 0);
+}
+
+// Returns false if the notification is gone, i.e. the child was killed after it was queued.
+bool SeccompInferior::Receive() {
+  struct seccomp_notif req;
+  memset(&req, 0, sizeof(req));
+  if (ioctl(listener_, SECCOMP_IOCTL_NOTIF_RECV, &req) != 0) {
+    CHECK(errno == ENOENT || errno == EINTR);
+    return false;
+  }
+  debug("id=%llx pid=%d rip=0x%llx, NR=%d\n", req.id, req.pid, req.data.instruction_pointer,
+        req.data.nr);
+  id_ = req.id;
+  sys_.nr = req.data.nr;
+  memcpy(sys_.args, req.data.args, sizeof(sys_.args));
+  return true;
+}
+
+Inferior::Stop SeccompInferior::Poll(bool block) {
+  struct epoll_event events[2];
+  while (1) {
+    int n = epoll_wait(epfd_, events, 2, block ? -1 : 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    CHECK(n >= 0);
+    bool terminated = false;
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.fd == pidfd_)
+        terminated = true;
+      else if ((events[i].events & EPOLLIN) && Receive())
+        return Stop::kSyscall;
+    }
+    if (terminated) {
+      CHECK(waitpid(pid_, &last_status_, 0) == pid_);
+      reaped_ = true;
+      return Stop::kTerminated;
+    }
+    if (!block)
+      return Stop::kNone;
+  }
+}
+
+void SeccompInferior::SetSyscallRet(long retval) const {
+  struct seccomp_notif_resp resp;
+  memset(&resp, 0, sizeof(resp));
+  resp.id = id_;
+  resp.val = retval;
+  // ENOENT: the child was killed while the call was being served, WaitForSys will notice
+  CHECK(ioctl(listener_, SECCOMP_IOCTL_NOTIF_SEND, &resp) == 0 || errno == ENOENT);
+}
@@ -0,0 +1,47 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _SECCOMP_INFERIOR_H
+#define _SECCOMP_INFERIOR_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "inferior.h"
+
+// Traps the chaos system calls with a SECCOMP_RET_USER_NOTIF filter installed by the child itself.
+// exit(2) goes to the kernel and any other system call fails with ENOSYS, as with PTRACE_SYSEMU.
+// Memory is only accessible through process_vm_{readv,writev}.
+class SeccompInferior : public Inferior {
+ public:
+  SeccompInferior(pid_t pid, int listener);
+  ~SeccompInferior() override;
+
+  // Forks a child that starts executing at pc with stack stk, once @setup succeeded in it.
+  static std::unique_ptr<Inferior> Spawn(void *pc, void *stk, const std::function<bool()> &setup);
+  // Stacks a filter on the calling process that kills it on the system calls only Spawn() needs,
+  // for sandboxes that trap with ptrace and never call it.
+  static void ForbidSpawn();
+
+  Stop Poll(bool block) override;
+  // Readable when a notification is pending or the child terminated.
+  int fd() const override { return epfd_; }
+  void SetSyscallRet(long retval) const override;
+  // SetSyscallRet already lets the child go
+  void Resume() override {}
+
+ private:
+  bool Receive();
+
+  int listener_;
+  int epfd_;
+  uint64_t id_;
+};
+
+#endif // _SECCOMP_INFERIOR_H
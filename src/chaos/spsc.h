@@ -0,0 +1,59 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _SPSC_H
+#define _SPSC_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "check.h"
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread. Indices
+// are free running, an entry lives at index % capacity.
+template <typename T>
+class SpscRing {
+ public:
+  // @capacity must be a power of two.
+  explicit SpscRing(uint32_t capacity) : slots_(capacity), mask_(capacity - 1), head_(0), tail_(0) {
+    CHECK(capacity && (capacity & mask_) == 0);
+  }
+
+  // Producer only, returns false if the ring is full.
+  bool Push(const T &value) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_)
+      return false;
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only, returns false if the ring is empty.
+  bool Pop(T &value) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+      return false;
+    value = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Exact from either end for the entries it produced or consumed, a bound otherwise.
+  inline uint32_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::vector<T> slots_;
+  const uint32_t mask_;
+  // on separate cache lines, each one is only written by one side
+  alignas(64) std::atomic<uint32_t> head_;
+  alignas(64) std::atomic<uint32_t> tail_;
+};
+
+#endif // _SPSC_H
@@ -0,0 +1,66 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#include "stats.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <ctime>
+
+#include "check.h"
+
+namespace stats {
+
+namespace {
+
+Page *page;
+
+}
+
+void Init() {
+  struct stat st;
+  if (fstat(kFd, &st) == 0 && st.st_size == kSize) {
+    page = static_cast<Page *>(mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_SHARED, kFd, 0));
+    close(kFd);
+  } else {
+    page = static_cast<Page *>(
+        mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  }
+  CHECK(page != MAP_FAILED);
+  CHECK(madvise(page, kSize, MADV_DONTFORK) == 0);
+  page->num_algos = kNumAlgos;
+  page->num_stages = kNumStages;
+  page->num_buckets = kNumBuckets;
+  page->num_counters = kNumCounters;
+  page->version = kVersion;
+  // published last, readers check it before trusting the rest
+  __atomic_store_n(&page->magic, kMagic, __ATOMIC_RELEASE);
+}
+
+uint64_t Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void Record(Stage stage, uint32_t algo, uint64_t ns) {
+  Histogram &hist = page->histograms[algo][stage];
+  uint32_t bucket = 63 - __builtin_clzll(ns | 1);
+  if (bucket >= kNumBuckets)
+    bucket = kNumBuckets - 1;
+  __atomic_fetch_add(&hist.buckets[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist.total_ns, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist.count, 1, __ATOMIC_RELAXED);
+}
+
+void Set(Counter counter, uint64_t value) {
+  __atomic_store_n(&page->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+}
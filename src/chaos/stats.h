@@ -0,0 +1,117 @@
+/*
+ * CHAOS - CryptograpHy AcceleratOr Silicon
+ *
+ * Copyright (c) 2021 david942j
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <cstdint>
+
+// Latency histograms and counters of the sandbox, always on. They live in a memfd shared with QEMU
+// so that host tools can read them while the device runs. Updates are relaxed atomic: readers may
+// see the count of a histogram and its buckets a few updates apart.
+namespace stats {
+
+enum Stage : uint32_t {
+  kWait, // the dispatcher waiting for events, spinning included
+  kSpawn, // forking a firmware process and attaching to it
+  kTrap, // a firmware process from being resumed to its next system call
+  kCopyIn, // preparing a crypto call, its input copied in from the firmware if needed
+  kCipher, // computing a crypto call
+  kCopyOut, // copying the output of a crypto call back to the firmware
+  kResponse, // from the oldest unanswered doorbell to signaling the host of responses
+  kNumStages,
+};
+
+// Histograms per stage are kept by algorithm, enum chaos_request_algo values up to kAlgoKey. Key
+// (un)registrations and key slot operations go to kAlgoKey, stages without an algorithm and
+// unknown ones to kAlgoNone.
+constexpr uint32_t kNumAlgos = 16;
+constexpr uint32_t kAlgoKey = kNumAlgos - 2;
+constexpr uint32_t kAlgoNone = kNumAlgos - 1;
+
+// buckets[i] counts latencies in [2^i, 2^(i+1)) nanoseconds, the last one all longer ones too.
+constexpr uint32_t kNumBuckets = 32;
+
+struct Histogram {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t buckets[kNumBuckets];
+};
+
+// Counters kept by the sandbox and its executors, published whenever a worker settles.
+enum Counter : uint32_t {
+  // waits of the dispatcher which saw their event while spinning, spun in vain and blocked, or
+  // blocked right away with spinning off
+  kSpinHits,
+  kSpinMisses,
+  kSpinBlocking,
+  // current spin budget in nanoseconds
+  kSpinBudget,
+  // firmware memory Read / Write calls served by process_vm_{readv,writev} and by ptrace
+  kCopyBulk,
+  kCopyPtrace,
+  // crypto buffers used directly from DRAM, without any copy
+  kInPlaceBuffers,
+  // see ArenaStats
+  kArenaAllocs,
+  kArenaSystem,
+  kArenaReturned,
+  // StageStats of each Pipeline::Stage in order, kStageCounters apart
+  kComputeTasks,
+  kComputeOccupancy,
+  kComputeMaxOccupancy,
+  kCopyOutTasks,
+  kCopyOutOccupancy,
+  kCopyOutMaxOccupancy,
+  kRespondTasks,
+  kRespondOccupancy,
+  kRespondMaxOccupancy,
+  // Pool::steals()
+  kPoolSteals,
+  kNumCounters,
+};
+
+constexpr uint32_t kStageCounters = kCopyOutTasks - kComputeTasks;
+
+constexpr uint32_t kMagic = 0x53544154; // "STAT"
+constexpr uint32_t kVersion = 2;
+
+// Layout of the memfd, passed as fd kFd. Keep kSize in sync with CHAOS_STATS_SIZE of QEMU.
+struct Page {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_algos;
+  uint32_t num_stages;
+  uint32_t num_buckets;
+  uint32_t num_counters;
+  uint32_t reserved[2];
+  Histogram histograms[kNumAlgos][kNumStages];
+  uint64_t counters[kNumCounters];
+};
+
+constexpr int kFd = 7;
+constexpr uint32_t kSize = 0x8000;
+static_assert(sizeof(Page) <= kSize);
+
+// Maps the memfd at kFd if QEMU passed one, or else private memory. Either way not inherited by
+// the firmware processes.
+void Init();
+
+// Monotonic clock in nanoseconds.
+uint64_t Now();
+
+void Record(Stage stage, uint32_t algo, uint64_t ns);
+
+// Records the time since @start.
+inline void RecordSince(Stage stage, uint32_t algo, uint64_t start) {
+  Record(stage, algo, Now() - start);
+}
+
+void Set(Counter counter, uint64_t value);
+
+}
+
+#endif // _STATS_H
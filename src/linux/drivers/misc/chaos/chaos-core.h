@@ -43,7 +43,9 @@ struct chaos_csrs {
 	uint64_t cmd_tail;
 	uint64_t rsp_head;
 	uint64_t rsp_tail;
-	uint64_t reserved[3];
+	/* number of key slots, set by the device before it reports the firmware loaded */
+	uint64_t key_slots;
+	uint64_t reserved[2];
 };
 
 int chaos_init(struct chaos_device *cdev);
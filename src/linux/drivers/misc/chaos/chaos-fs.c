@@ -21,12 +21,17 @@
 static int chaos_client_init(struct chaos_device *cdev, struct chaos_client *client)
 {
 	mutex_init(&client->lock);
+	init_rwsem(&client->key_sem);
 	client->cdev = cdev;
 	return 0;
 }
 
 static void chaos_client_exit(struct chaos_client *client)
 {
+	u32 slot;
+
+	for_each_set_bit(slot, client->key_slots, CHAOS_MAX_KEY_SLOTS)
+		chaos_mailbox_key_destroy(client->cdev->mbox, slot);
 	if (client->buf.size != 0)
 		chaos_dram_free(client->cdev->dpool, &client->buf);
 }
@@ -70,10 +75,12 @@ static int chaos_ioctl_request(struct chaos_client *client, void __user *arg)
 	struct chaos_request orig_req, req;
 	size_t offset;
 	size_t size;
+	bool key_slot;
 	int ret;
 
 	if (copy_from_user(&req, arg, sizeof(req)))
 		return -EFAULT;
+	key_slot = req.algo & CHAOS_REQUEST_KEY_SLOT;
 
 	mutex_lock(&client->lock);
 	size = client->buf.size;
@@ -91,7 +98,10 @@ static int chaos_ioctl_request(struct chaos_client *client, void __user *arg)
 	} else {
 		req.input = 0;
 	}
-	if (req.key_size != 0) {
+	if (key_slot) {
+		/* the slot is all the device needs, nothing to transfer */
+		req.key_size = 0;
+	} else if (req.key_size != 0) {
 		if (req.key >= size)
 			return -EINVAL;
 		req.key += offset;
@@ -105,7 +115,16 @@ static int chaos_ioctl_request(struct chaos_client *client, void __user *arg)
 	} else {
 		req.output = 0;
 	}
-	ret = chaos_mailbox_request(client->cdev->mbox, &req);
+	if (key_slot) {
+		down_read(&client->key_sem);
+		if (req.key >= CHAOS_MAX_KEY_SLOTS || !test_bit(req.key, client->key_slots))
+			ret = -EINVAL;
+		else
+			ret = chaos_mailbox_request(client->cdev->mbox, &req);
+		up_read(&client->key_sem);
+	} else {
+		ret = chaos_mailbox_request(client->cdev->mbox, &req);
+	}
 	if (ret)
 		return ret;
 	orig_req.out_size = req.out_size;
@@ -114,6 +133,48 @@ static int chaos_ioctl_request(struct chaos_client *client, void __user *arg)
 	return 0;
 }
 
+static int chaos_ioctl_key_load(struct chaos_client *client, void __user *arg)
+{
+	struct chaos_key key;
+	size_t size;
+	int ret;
+
+	if (copy_from_user(&key, arg, sizeof(key)))
+		return -EFAULT;
+
+	mutex_lock(&client->lock);
+	size = client->buf.size;
+	mutex_unlock(&client->lock);
+	if (size == 0)
+		return -ENOSPC;
+	if (key.key_size == 0 || key.key >= size || key.key_size > size - key.key)
+		return -EINVAL;
+	/* @size is not zero implies buf allocated, no need to hold @lock */
+	ret = chaos_mailbox_key_load(client->cdev->mbox,
+				     key.key + CHAOS_DRAM_OFFSET(client->cdev->dpool, &client->buf),
+				     key.key_size);
+	if (ret < 0)
+		return ret;
+	key.slot = ret;
+	set_bit(key.slot, client->key_slots);
+	if (copy_to_user(arg, &key, sizeof(key)))
+		return -EFAULT;
+	return 0;
+}
+
+static int chaos_ioctl_key_destroy(struct chaos_client *client, u32 slot)
+{
+	int ret = 0;
+
+	down_write(&client->key_sem);
+	if (slot >= CHAOS_MAX_KEY_SLOTS || !test_and_clear_bit(slot, client->key_slots))
+		ret = -EINVAL;
+	else
+		chaos_mailbox_key_destroy(client->cdev->mbox, slot);
+	up_write(&client->key_sem);
+	return ret;
+}
+
 static long chaos_fs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct chaos_client *client = file->private_data;
@@ -123,6 +184,10 @@ static long chaos_fs_ioctl(struct file *file, unsigned int cmd, unsigned long ar
 		return chaos_ioctl_allocate_buffer(client, arg);
 	case CHAOS_REQUEST:
 		return chaos_ioctl_request(client, (void __user*)arg);
+	case CHAOS_KEY_LOAD:
+		return chaos_ioctl_key_load(client, (void __user*)arg);
+	case CHAOS_KEY_DESTROY:
+		return chaos_ioctl_key_destroy(client, arg);
 	default:
 		return -ENOTTY;
 	}
@@ -8,10 +8,13 @@
 #ifndef _CHAOS_FS_H
 #define _CHAOS_FS_H
 
+#include <linux/bitmap.h>
 #include <linux/miscdevice.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
 
 #include "chaos-core.h"
+#include "chaos-mailbox.h"
 
 /* Each file descriptor creates one client. */
 struct chaos_client {
@@ -19,6 +22,11 @@ struct chaos_client {
 	/* fields protected by @lock */
 
 	struct chaos_resource buf;
+	/* key slots of the device owned by this client */
+	DECLARE_BITMAP(key_slots, CHAOS_MAX_KEY_SLOTS);
+
+	/* held for reading by requests using a key slot, so that none is destroyed under them */
+	struct rw_semaphore key_sem;
 
 	/* constant fields */
 
@@ -49,11 +49,12 @@ static int chaos_push_cmd_and_wait(struct chaos_mailbox *mbox, const struct chao
 		mutex_unlock(&mbox->cmdq_lock);
 		return -EBUSY;
 	}
+	/* before the device can see the command, its response may come back before cmd_sent */
+	mbox->responses[idx].retval = WAITING_RESPONSE;
 	memcpy(&queue[REAL_INDEX(tail)], cmd, sizeof(*cmd));
 	CHAOS_WRITE(cdev, cmd_tail, queue_inc(tail));
 	mutex_unlock(&mbox->cmdq_lock);
 
-	mbox->responses[idx].retval = WAITING_RESPONSE;
 	CHAOS_WRITE(cdev, cmd_sent, 1);
 
 	ret = wait_event_timeout(mbox->waitq, (val = mbox->responses[idx].retval) != WAITING_RESPONSE,
@@ -86,6 +87,8 @@ struct chaos_mailbox *chaos_mailbox_init(struct chaos_device *cdev)
 	spin_lock_init(&mbox->rspq_lock);
 	init_waitqueue_head(&mbox->waitq);
 	atomic_set(&mbox->next_seq, 0);
+	mutex_init(&mbox->key_lock);
+	mbox->num_key_slots = min_t(u64, CHAOS_READ(cdev, key_slots), CHAOS_MAX_KEY_SLOTS);
 	CHAOS_WRITE(cdev, cmdq_addr, mbox->cmdq.paddr - cdev->dram.paddr);
 	CHAOS_WRITE(cdev, cmdq_size, CHAOS_QUEUE_SIZE);
 	CHAOS_WRITE(cdev, rspq_addr, mbox->rspq.paddr - cdev->dram.paddr);
@@ -105,8 +108,10 @@ void chaos_mailbox_handle_irq(struct chaos_mailbox *mbox)
 	struct chaos_device *cdev = mbox->cdev;
 	struct chaos_mailbox_rsp *queue = mbox->rspq.vaddr;
 	u64 head = CHAOS_READ(cdev, rsp_head);
+	bool full;
 
 	spin_lock(&mbox->rspq_lock);
+	full = queue_full(head, CHAOS_READ(cdev, rsp_tail));
 	while (head != CHAOS_READ(cdev, rsp_tail)) {
 		struct chaos_mailbox_rsp rsp = queue[REAL_INDEX(head)];
 		const size_t idx = rsp.seq % CHAOS_QUEUE_SIZE;
@@ -116,35 +121,93 @@ void chaos_mailbox_handle_irq(struct chaos_mailbox *mbox)
 	}
 	CHAOS_WRITE(cdev, rsp_head, head);
 	spin_unlock(&mbox->rspq_lock);
+	/* the firmware stops a batch on a full response queue, kick it for the commands left */
+	if (full)
+		CHAOS_WRITE(cdev, cmd_sent, 1);
 	wake_up(&mbox->waitq);
 }
 
-int chaos_mailbox_request(struct chaos_mailbox *mbox, struct chaos_request *req)
+/*
+ * Sends a command of @code with a copy of @data in DRAM and waits for its response.
+ * Returns -EPROTO if the firmware answered with an error.
+ */
+static int chaos_mailbox_send(struct chaos_mailbox *mbox, u8 code, const void *data, size_t size,
+			      u32 *retval)
 {
 	struct chaos_mailbox_cmd cmd = {
 		.seq = atomic_inc_return(&mbox->next_seq),
-		.code = CHAOS_CMD_CODE_REQUEST,
+		.code = code,
 	};
 	struct chaos_dram_pool *dpool = mbox->cdev->dpool;
 	struct chaos_resource buf;
 	int ret;
-	u32 retval = 0;
 
-	ret = chaos_dram_alloc(dpool, sizeof(*req), &buf);
+	ret = chaos_dram_alloc(dpool, size, &buf);
 	if (ret)
 		return ret;
 	cmd.dma_addr = CHAOS_DRAM_OFFSET(dpool, &buf);
-	cmd.dma_size = sizeof(*req);
-	memcpy(buf.vaddr, req, sizeof(*req));
-	ret = chaos_push_cmd_and_wait(mbox, &cmd, &retval);
+	cmd.dma_size = size;
+	memcpy(buf.vaddr, data, size);
+	ret = chaos_push_cmd_and_wait(mbox, &cmd, retval);
 	chaos_dram_free(dpool, &buf);
 	if (ret)
 		return ret;
 	/* FW returned an error */
-	if ((int)retval < 0) {
-		dev_err(mbox->cdev->dev, "%s: fw returns an error: %d", __func__, (int)retval);
+	if ((int)*retval < 0) {
+		dev_err(mbox->cdev->dev, "%s: fw returns an error on code %u: %d", __func__, code,
+			(int)*retval);
 		return -EPROTO;
 	}
+	return 0;
+}
+
+int chaos_mailbox_request(struct chaos_mailbox *mbox, struct chaos_request *req)
+{
+	int ret;
+	u32 retval = 0;
+
+	ret = chaos_mailbox_send(mbox, CHAOS_CMD_CODE_REQUEST, req, sizeof(*req), &retval);
+	if (ret)
+		return ret;
 	req->out_size = retval;
 	return 0;
 }
+
+int chaos_mailbox_key_load(struct chaos_mailbox *mbox, u32 key, u32 key_size)
+{
+	struct chaos_mailbox_key mkey = {
+		.key = key,
+		.key_size = key_size,
+	};
+	u32 slot;
+	int ret;
+	u32 retval = 0;
+
+	mutex_lock(&mbox->key_lock);
+	slot = find_first_zero_bit(mbox->key_slots, mbox->num_key_slots);
+	if (slot < mbox->num_key_slots)
+		set_bit(slot, mbox->key_slots);
+	mutex_unlock(&mbox->key_lock);
+	if (slot >= mbox->num_key_slots)
+		return -ENOSPC;
+	mkey.slot = slot;
+	ret = chaos_mailbox_send(mbox, CHAOS_CMD_CODE_KEY_LOAD, &mkey, sizeof(mkey), &retval);
+	/* the device may still fill a slot whose command timed out, leave it taken */
+	if (ret && ret != -ETIMEDOUT)
+		clear_bit(slot, mbox->key_slots);
+	if (ret)
+		return ret;
+	return slot;
+}
+
+void chaos_mailbox_key_destroy(struct chaos_mailbox *mbox, u32 slot)
+{
+	struct chaos_mailbox_key mkey = {
+		.slot = slot,
+	};
+	u32 retval = 0;
+
+	/* the key is overwritten by the next load of the slot anyway, errors are not fatal */
+	chaos_mailbox_send(mbox, CHAOS_CMD_CODE_KEY_DESTROY, &mkey, sizeof(mkey), &retval);
+	clear_bit(slot, mbox->key_slots);
+}
@@ -9,6 +9,7 @@
 #define _CHAOS_MAILBOX_H
 
 #include <linux/atomic.h>
+#include <linux/bitmap.h>
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 
@@ -21,6 +22,18 @@
 
 enum chaos_command_code {
 	CHAOS_CMD_CODE_REQUEST = 1,
+	CHAOS_CMD_CODE_KEY_LOAD = 2,
+	CHAOS_CMD_CODE_KEY_DESTROY = 3,
+};
+
+/* most key slots used, whatever the device advertises */
+#define CHAOS_MAX_KEY_SLOTS 64
+
+/* pointed to by the dma_addr of CHAOS_CMD_CODE_KEY_{LOAD,DESTROY}, @key unused by the latter */
+struct chaos_mailbox_key {
+	uint32_t slot;
+	uint32_t key;
+	uint32_t key_size;
 };
 
 struct chaos_mailbox_cmd {
@@ -44,6 +57,10 @@ struct chaos_mailbox {
 	struct chaos_mailbox_rsp *responses;
 	wait_queue_head_t waitq;
 	atomic_t next_seq;
+	/* key slots in use by any client */
+	struct mutex key_lock;
+	DECLARE_BITMAP(key_slots, CHAOS_MAX_KEY_SLOTS);
+	u32 num_key_slots;
 	struct chaos_device *cdev;
 };
 
@@ -54,4 +71,12 @@ void chaos_mailbox_handle_irq(struct chaos_mailbox *mbox);
 
 int chaos_mailbox_request(struct chaos_mailbox *mbox, struct chaos_request *req);
 
+/*
+ * Installs the key at DRAM offset @key into a free slot.
+ * Returns the slot on success, or a negative errno.
+ */
+int chaos_mailbox_key_load(struct chaos_mailbox *mbox, u32 key, u32 key_size);
+/* Frees @slot, which must have been returned by chaos_mailbox_key_load(). */
+void chaos_mailbox_key_destroy(struct chaos_mailbox *mbox, u32 slot);
+
 #endif /* _CHAOS_MAILBOX_H */
@@ -34,6 +34,12 @@ enum chaos_request_algo {
 	CHAOS_ALGO_FFF_DEC,
 };
 
+/*
+ * Or'ed into the algo of a request to take its key from a slot loaded by CHAOS_KEY_LOAD: @key is
+ * then the slot and @key_size is ignored.
+ */
+#define CHAOS_REQUEST_KEY_SLOT 0x100
+
 struct chaos_request {
 	enum chaos_request_algo algo;
 	u_int32_t input;
@@ -52,4 +58,28 @@ struct chaos_request {
 
 #define CHAOS_REQUEST _IOWR(CHAOS_IOC_MAGIC, 0, struct chaos_request)
 
+struct chaos_key {
+	/* offset and size of the key in the buffer of the client */
+	u_int32_t key;
+	u_int32_t key_size;
+	/* set to the slot holding the key on success */
+	u_int32_t slot;
+};
+
+/*
+ * Installs a key into a slot of the device once, for requests with CHAOS_REQUEST_KEY_SLOT to use
+ * without transferring it again. The slot belongs to this file descriptor until CHAOS_KEY_DESTROY
+ * or its release.
+ *
+ * Returns 0 on success, -ENOSPC if all slots of the device are taken.
+ */
+#define CHAOS_KEY_LOAD _IOWR(CHAOS_IOC_MAGIC, 1, struct chaos_key)
+
+/*
+ * Frees the slot given as argument.
+ *
+ * Returns 0 on success, -EINVAL if the slot is not one of this file descriptor.
+ */
+#define CHAOS_KEY_DESTROY _IOW(CHAOS_IOC_MAGIC, 2, u_int32_t)
+
 #endif /* _CHAOS_H */
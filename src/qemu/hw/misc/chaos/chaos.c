@@ -17,6 +17,7 @@
 #include "exec/memory.h"
 #include "hw/pci/pci.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 
 /* #define DEBUG */
 
@@ -32,6 +33,14 @@
 
 /* 1 MB */
 #define CHAOS_DEVICE_DRAM_SIZE (1 << 20)
+/* keep in sync with kMaxInferiors of the sandbox */
+#define CHAOS_MAX_INFERIORS 16
+/* keep in sync with kMaxCryptoThreads of the sandbox */
+#define CHAOS_MAX_CRYPTO_THREADS 16
+/* keep in sync with kMaxSpin of the sandbox */
+#define CHAOS_MAX_SPIN 1000
+/* latency histograms of the sandbox, keep in sync with stats::kSize of the sandbox */
+#define CHAOS_STATS_SIZE 0x8000
 
 struct share_mem {
     int fd;
@@ -44,10 +53,25 @@ typedef struct {
     MemoryRegion mem_csrs, mem_dram;
     QemuThread thread;
 
-    struct share_mem csr, dram;
+    struct share_mem csr, dram, stats;
     pid_t devpid;
     int evtfd_to_dev, evtfd_from_dev;
     const char *sandbox_path;
+    const char *trap;
+    uint32_t inferiors;
+    uint32_t crypto_threads;
+    uint32_t spin;
+    bool pipeline;
+    /* runtime tuning, see the properties */
+    const char *sandbox_cpus;
+    const char *firmware_cpus;
+    const char *sched;
+    bool mlock;
+    const char *verify_cache;
+    bool portable_crypto;
+    /* mailbox traffic recording, see the properties */
+    const char *capture;
+    bool capture_inputs;
     bool fw_checked;
 } ChaosState;
 
@@ -65,7 +89,8 @@ struct Csrs {
     uint64_t cmd_tail; /* W */
     uint64_t rsp_head; /* W */
     uint64_t rsp_tail; /* R */
-    uint64_t reserved[3];
+    uint64_t key_slots; /* R, set by the sandbox */
+    uint64_t reserved[2];
 };
 
 static void chaos_raise_irq(ChaosState *chaos)
@@ -134,8 +159,37 @@ static void launch_sandbox(ChaosState *chaos)
         dup_and_close(chaos->dram.fd, 4);
         dup_and_close(chaos->evtfd_to_dev, 5);
         dup_and_close(chaos->evtfd_from_dev, 6);
-        const char *const argv[] = { "sandbox", NULL };
-        execv(chaos->sandbox_path, (char *const *)argv);
+        dup_and_close(chaos->stats.fd, 7);
+        char *trap = g_strdup_printf("--trap=%s", chaos->trap ? chaos->trap : "ptrace");
+        char *inferiors = g_strdup_printf("--inferiors=%u", chaos->inferiors ? chaos->inferiors : 1);
+        char *crypto_threads = g_strdup_printf("--crypto-threads=%u", chaos->crypto_threads);
+        char *spin = g_strdup_printf("--spin=%u", chaos->spin);
+        GPtrArray *argv = g_ptr_array_new();
+        g_ptr_array_add(argv, (gpointer)"sandbox");
+        g_ptr_array_add(argv, trap);
+        g_ptr_array_add(argv, inferiors);
+        g_ptr_array_add(argv, crypto_threads);
+        g_ptr_array_add(argv, spin);
+        if (chaos->pipeline)
+            g_ptr_array_add(argv, (gpointer)"--pipeline");
+        if (chaos->sandbox_cpus)
+            g_ptr_array_add(argv, g_strdup_printf("--sandbox-cpus=%s", chaos->sandbox_cpus));
+        if (chaos->firmware_cpus)
+            g_ptr_array_add(argv, g_strdup_printf("--firmware-cpus=%s", chaos->firmware_cpus));
+        if (chaos->sched)
+            g_ptr_array_add(argv, g_strdup_printf("--sched=%s", chaos->sched));
+        if (chaos->mlock)
+            g_ptr_array_add(argv, (gpointer)"--mlock");
+        if (chaos->verify_cache)
+            g_ptr_array_add(argv, g_strdup_printf("--verify-cache=%s", chaos->verify_cache));
+        if (chaos->portable_crypto)
+            g_ptr_array_add(argv, (gpointer)"--portable-crypto");
+        if (chaos->capture)
+            g_ptr_array_add(argv, g_strdup_printf("--capture=%s", chaos->capture));
+        if (chaos->capture_inputs)
+            g_ptr_array_add(argv, (gpointer)"--capture-inputs");
+        g_ptr_array_add(argv, NULL);
+        execv(chaos->sandbox_path, (char *const *)argv->pdata);
         g_assert(false);
     }
     debug("child = %d\n", pid);
@@ -190,6 +244,8 @@ static void chaos_chip_init(ChaosState *chaos)
     chaos->fw_checked = false;
     share_mem_init("dev-csr", sizeof(struct Csrs), &chaos->csr);
     share_mem_init("dev-dram", CHAOS_DEVICE_DRAM_SIZE, &chaos->dram);
+    /* kept mapped for host tools, e.g. through /proc/<pid>/fd */
+    share_mem_init("dev-stats", CHAOS_STATS_SIZE, &chaos->stats);
     chaos->evtfd_to_dev = eventfd(0, 0);
     chaos->evtfd_from_dev = eventfd(0, 0);
     launch_sandbox(chaos);
@@ -203,6 +259,7 @@ static void chaos_chip_exit(ChaosState *chaos)
     qemu_thread_join(&chaos->thread);
     close(chaos->evtfd_from_dev);
     close(chaos->evtfd_to_dev);
+    share_mem_exit(&chaos->stats);
     share_mem_exit(&chaos->dram);
     share_mem_exit(&chaos->csr);
 }
@@ -240,6 +297,8 @@ static void chaos_csr_write(void *opaque, hwaddr addr, uint64_t val,
         return;
     case offsetof(struct Csrs, clear_irq):
         return chaos_lower_irq(chaos);
+    case offsetof(struct Csrs, key_slots):
+        return;
     case offsetof(struct Csrs, load_addr):
         *(uint64_t *)(chaos->csr.addr + addr) = val;
         return chaos_interrupt_to_device(chaos);
@@ -368,6 +427,222 @@ static char *chaos_get_sandbox(Object *obj, Error **errp)
     return g_strdup(chaos->sandbox_path);
 }
 
+static void chaos_set_trap(Object *obj, const char *value, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    if (!strcmp(value, "ptrace") || !strcmp(value, "seccomp")) {
+        chaos->trap = g_strdup(value);
+    } else {
+        error_setg(errp, "Trap must be \"ptrace\" or \"seccomp\".");
+    }
+}
+
+static char *chaos_get_trap(Object *obj, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    return g_strdup(chaos->trap ? chaos->trap : "ptrace");
+}
+
+static void chaos_set_inferiors(Object *obj, Visitor *v, const char *name, void *opaque,
+                                Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp))
+        return;
+    if (value < 1 || value > CHAOS_MAX_INFERIORS) {
+        error_setg(errp, "Inferiors must be between 1 and %d.", CHAOS_MAX_INFERIORS);
+        return;
+    }
+    chaos->inferiors = value;
+}
+
+static void chaos_get_inferiors(Object *obj, Visitor *v, const char *name, void *opaque,
+                                Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+    uint32_t value = chaos->inferiors ? chaos->inferiors : 1;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void chaos_set_crypto_threads(Object *obj, Visitor *v, const char *name, void *opaque,
+                                     Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp))
+        return;
+    if (value > CHAOS_MAX_CRYPTO_THREADS) {
+        error_setg(errp, "Crypto threads must be at most %d.", CHAOS_MAX_CRYPTO_THREADS);
+        return;
+    }
+    chaos->crypto_threads = value;
+}
+
+static void chaos_get_crypto_threads(Object *obj, Visitor *v, const char *name, void *opaque,
+                                     Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    visit_type_uint32(v, name, &chaos->crypto_threads, errp);
+}
+
+static void chaos_set_spin(Object *obj, Visitor *v, const char *name, void *opaque,
+                           Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp))
+        return;
+    if (value > CHAOS_MAX_SPIN) {
+        error_setg(errp, "Spin must be at most %d microseconds.", CHAOS_MAX_SPIN);
+        return;
+    }
+    chaos->spin = value;
+}
+
+static void chaos_get_spin(Object *obj, Visitor *v, const char *name, void *opaque,
+                           Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    visit_type_uint32(v, name, &chaos->spin, errp);
+}
+
+static bool chaos_get_pipeline(Object *obj, Error **errp)
+{
+    return CHAOS(obj)->pipeline;
+}
+
+static void chaos_set_pipeline(Object *obj, bool value, Error **errp)
+{
+    CHAOS(obj)->pipeline = value;
+}
+
+/* CPU lists such as "0-3,6", checked in detail by the sandbox */
+static bool chaos_valid_cpus(const char *value)
+{
+    return *value && strspn(value, "0123456789,-") == strlen(value);
+}
+
+static void chaos_set_sandbox_cpus(Object *obj, const char *value, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    if (chaos_valid_cpus(value)) {
+        chaos->sandbox_cpus = g_strdup(value);
+    } else {
+        error_setg(errp, "Sandbox CPUs must be a CPU list such as \"0-3,6\".");
+    }
+}
+
+static char *chaos_get_sandbox_cpus(Object *obj, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    return g_strdup(chaos->sandbox_cpus ? chaos->sandbox_cpus : "");
+}
+
+static void chaos_set_firmware_cpus(Object *obj, const char *value, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    if (chaos_valid_cpus(value)) {
+        chaos->firmware_cpus = g_strdup(value);
+    } else {
+        error_setg(errp, "Firmware CPUs must be a CPU list such as \"0-3,6\".");
+    }
+}
+
+static char *chaos_get_firmware_cpus(Object *obj, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    return g_strdup(chaos->firmware_cpus ? chaos->firmware_cpus : "");
+}
+
+static void chaos_set_sched(Object *obj, const char *value, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    if (g_str_has_prefix(value, "fifo:") || g_str_has_prefix(value, "nice:")) {
+        chaos->sched = g_strdup(value);
+    } else {
+        error_setg(errp, "Sched must be \"fifo:<priority>\" or \"nice:<value>\".");
+    }
+}
+
+static char *chaos_get_sched(Object *obj, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    return g_strdup(chaos->sched ? chaos->sched : "");
+}
+
+static bool chaos_get_mlock(Object *obj, Error **errp)
+{
+    return CHAOS(obj)->mlock;
+}
+
+static void chaos_set_mlock(Object *obj, bool value, Error **errp)
+{
+    CHAOS(obj)->mlock = value;
+}
+
+static void chaos_set_verify_cache(Object *obj, const char *value, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    chaos->verify_cache = g_strdup(value);
+}
+
+static char *chaos_get_verify_cache(Object *obj, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    return g_strdup(chaos->verify_cache ? chaos->verify_cache : "");
+}
+
+static bool chaos_get_portable_crypto(Object *obj, Error **errp)
+{
+    return CHAOS(obj)->portable_crypto;
+}
+
+static void chaos_set_portable_crypto(Object *obj, bool value, Error **errp)
+{
+    CHAOS(obj)->portable_crypto = value;
+}
+
+static void chaos_set_capture(Object *obj, const char *value, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    chaos->capture = g_strdup(value);
+}
+
+static char *chaos_get_capture(Object *obj, Error **errp)
+{
+    ChaosState *chaos = CHAOS(obj);
+
+    return g_strdup(chaos->capture ? chaos->capture : "");
+}
+
+static bool chaos_get_capture_inputs(Object *obj, Error **errp)
+{
+    return CHAOS(obj)->capture_inputs;
+}
+
+static void chaos_set_capture_inputs(Object *obj, bool value, Error **errp)
+{
+    CHAOS(obj)->capture_inputs = value;
+}
+
 static void chaos_class_init(ObjectClass *class, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(class);
@@ -385,6 +660,57 @@ static void chaos_class_init(ObjectClass *class, void *data)
                                   chaos_set_sandbox);
     object_class_property_set_description(class, "sandbox",
                                           "Set the path to the sandbox.");
+    object_class_property_add_str(class, "trap", chaos_get_trap,
+                                  chaos_set_trap);
+    object_class_property_set_description(class, "trap",
+                                          "Firmware syscall trap: ptrace (default) or seccomp.");
+    object_class_property_add(class, "inferiors", "uint32", chaos_get_inferiors,
+                              chaos_set_inferiors, NULL, NULL);
+    object_class_property_set_description(class, "inferiors",
+                                          "Firmware processes serving commands concurrently (default 1).");
+    object_class_property_add(class, "crypto-threads", "uint32", chaos_get_crypto_threads,
+                              chaos_set_crypto_threads, NULL, NULL);
+    object_class_property_set_description(class, "crypto-threads",
+                                          "Threads computing crypto requests, 0 (default) computes them inline.");
+    object_class_property_add(class, "spin", "uint32", chaos_get_spin, chaos_set_spin, NULL, NULL);
+    object_class_property_set_description(class, "spin",
+                                          "Microseconds the sandbox polls at most before it blocks for events, "
+                                          "adapted to the traffic. 0 (default) always blocks.");
+    object_class_property_add_bool(class, "pipeline", chaos_get_pipeline, chaos_set_pipeline);
+    object_class_property_set_description(class, "pipeline",
+                                          "Compute and copy out crypto requests on a staged pipeline instead.");
+    object_class_property_add_str(class, "sandbox-cpus", chaos_get_sandbox_cpus,
+                                  chaos_set_sandbox_cpus);
+    object_class_property_set_description(class, "sandbox-cpus",
+                                          "CPUs the sandbox and its threads run on, e.g. \"2-3\".");
+    object_class_property_add_str(class, "firmware-cpus", chaos_get_firmware_cpus,
+                                  chaos_set_firmware_cpus);
+    object_class_property_set_description(class, "firmware-cpus",
+                                          "CPUs the firmware processes are pinned to, one each in turn.");
+    object_class_property_add_str(class, "sched", chaos_get_sched, chaos_set_sched);
+    object_class_property_set_description(class, "sched",
+                                          "Scheduling of the sandbox and its threads: fifo:<priority> or nice:<value>.");
+    object_class_property_add_bool(class, "mlock", chaos_get_mlock, chaos_set_mlock);
+    object_class_property_set_description(class, "mlock",
+                                          "Fault in and lock the device memory in the sandbox and firmware.");
+    object_class_property_add_str(class, "verify-cache", chaos_get_verify_cache,
+                                  chaos_set_verify_cache);
+    object_class_property_set_description(class, "verify-cache",
+                                          "File of firmware images verified before, shared by trusted instances "
+                                          "to skip their RSA verification.");
+    object_class_property_add_bool(class, "portable-crypto", chaos_get_portable_crypto,
+                                   chaos_set_portable_crypto);
+    object_class_property_set_description(class, "portable-crypto",
+                                          "Compute with the portable cipher code even where the CPU has "
+                                          "instructions for it, AES-NI or AVX2.");
+    object_class_property_add_str(class, "capture", chaos_get_capture, chaos_set_capture);
+    object_class_property_set_description(class, "capture",
+                                          "File to record the mailbox commands and their answers to, "
+                                          "for replaying them with the bench of the sandbox.");
+    object_class_property_add_bool(class, "capture-inputs", chaos_get_capture_inputs,
+                                   chaos_set_capture_inputs);
+    object_class_property_set_description(class, "capture-inputs",
+                                          "Record the input bytes of commands too, not only their sizes.");
 
 }
 
@@ -302,6 +302,132 @@ static void test_fff(void) {
   munmap(buf, 0x200);
 }
 
+static void test_key_load(void) {
+  int fd = OPEN();
+  struct chaos_key key = { .key = 0x100, .key_size = 16 };
+  // buffer not allocated
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_LOAD, &key, ENOSPC);
+
+  ASSERT_IOCTL_OK(fd, CHAOS_ALLOCATE_BUFFER, 0x200);
+
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_LOAD, 0x123, EFAULT);
+  key.key_size = 0;
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_LOAD, &key, EINVAL);
+  key.key_size = 0x101;
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_LOAD, &key, EINVAL);
+  key.key = 0x200; key.key_size = 1;
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_LOAD, &key, EINVAL);
+
+  key.key = 0x100; key.key_size = 16;
+  ASSERT_IOCTL_OK(fd, CHAOS_KEY_LOAD, &key);
+  ASSERT_IOCTL_OK(fd, CHAOS_KEY_DESTROY, key.slot);
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_DESTROY, key.slot, EINVAL);
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_DESTROY, 0x12345, EINVAL);
+
+  struct chaos_request req = {
+    .algo = CHAOS_ALGO_AES_ENC | CHAOS_REQUEST_KEY_SLOT,
+    .input = 0x0,
+    .in_size = 16,
+    .key = key.slot,
+    .output = 0x0,
+    .out_size = 0x100,
+  };
+  // destroyed
+  ASSERT_IOCTL_ERR(fd, CHAOS_REQUEST, &req, EINVAL);
+  req.key = 0x12345;
+  ASSERT_IOCTL_ERR(fd, CHAOS_REQUEST, &req, EINVAL);
+
+  // slots belong to the file descriptor that loaded them
+  int fd2 = OPEN();
+  ASSERT_IOCTL_OK(fd2, CHAOS_ALLOCATE_BUFFER, 0x200);
+  ASSERT_IOCTL_OK(fd, CHAOS_KEY_LOAD, &key);
+  req.key = key.slot;
+  ASSERT_IOCTL_ERR(fd2, CHAOS_REQUEST, &req, EINVAL);
+  ASSERT_IOCTL_ERR(fd2, CHAOS_KEY_DESTROY, key.slot, EINVAL);
+  ASSERT_IOCTL_OK(fd, CHAOS_REQUEST, &req);
+  close(fd2);
+  close(fd);
+}
+
+// Requests with a key slot must give what the same requests with the key inline give.
+static void test_key_slot_request(void) {
+  static const struct {
+    enum chaos_request_algo algo;
+    u_int32_t size, key_size;
+  } cases[] = {
+    { CHAOS_ALGO_AES_ENC, 0x40, 16 },
+    { CHAOS_ALGO_AES_DEC, 0x40, 16 },
+    { CHAOS_ALGO_RC4_ENC, 0x33, 20 },
+    { CHAOS_ALGO_BF_ENC, 0x40, 12 },
+    { CHAOS_ALGO_BF_DEC, 0x40, 12 },
+    { CHAOS_ALGO_TF_ENC, 0x40, 16 },
+    { CHAOS_ALGO_FFF_DEC, 0x40, 32 },
+  };
+  int fd = OPEN();
+  ASSERT_IOCTL_OK(fd, CHAOS_ALLOCATE_BUFFER, 0x400);
+  u_int8_t *buf = mmap(0, 0x400, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(buf != MAP_FAILED);
+  u_int8_t *inline_out = buf, *slot_out = buf + 0x100, *key = buf + 0x300;
+
+  for (int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    struct chaos_key k = { .key = 0x300, .key_size = cases[c].key_size };
+    for (int i = 0; i < k.key_size; i++)
+      key[i] = i * 3 + c;
+    ASSERT_IOCTL_OK(fd, CHAOS_KEY_LOAD, &k);
+    // twice, the key in the slot must be left as loaded
+    for (int round = 0; round < 2; round++) {
+      struct chaos_request req = {
+        .algo = cases[c].algo,
+        .input = 0x0,
+        .in_size = cases[c].size,
+        .key = 0x300,
+        .key_size = k.key_size,
+        .output = 0x0,
+        .out_size = 0x100,
+      };
+      for (int i = 0; i < req.in_size; i++)
+        inline_out[i] = slot_out[i] = i * 2;
+      ASSERT_IOCTL_OK(fd, CHAOS_REQUEST, &req);
+      assert(req.out_size == cases[c].size);
+      // the key in the buffer is not used any more
+      memset(key, 0, k.key_size);
+      req.algo |= CHAOS_REQUEST_KEY_SLOT;
+      req.input = req.output = 0x100;
+      req.key = k.slot;
+      req.key_size = 0;
+      req.out_size = 0x100;
+      ASSERT_IOCTL_OK(fd, CHAOS_REQUEST, &req);
+      assert(req.out_size == cases[c].size);
+      assert(memcmp(inline_out, slot_out, cases[c].size) == 0);
+      for (int i = 0; i < k.key_size; i++)
+        key[i] = i * 3 + c;
+    }
+    ASSERT_IOCTL_OK(fd, CHAOS_KEY_DESTROY, k.slot);
+  }
+  close(fd);
+  munmap(buf, 0x400);
+}
+
+// Slots of a file descriptor are freed on its release.
+static void test_key_slot_release(void) {
+  struct chaos_key key = { .key = 0, .key_size = 16 };
+  int fd = OPEN();
+  int n = 0;
+  ASSERT_IOCTL_OK(fd, CHAOS_ALLOCATE_BUFFER, 0x100);
+  while (ioctl(fd, CHAOS_KEY_LOAD, &key) == 0)
+    n++;
+  assert(errno == ENOSPC);
+  assert(n > 0);
+  close(fd);
+
+  fd = OPEN();
+  ASSERT_IOCTL_OK(fd, CHAOS_ALLOCATE_BUFFER, 0x100);
+  for (int i = 0; i < n; i++)
+    ASSERT_IOCTL_OK(fd, CHAOS_KEY_LOAD, &key);
+  ASSERT_IOCTL_ERR(fd, CHAOS_KEY_LOAD, &key, ENOSPC);
+  close(fd);
+}
+
 int main() {
   test_allocate_buffer();
   test_request();
@@ -311,6 +437,9 @@ int main() {
   test_bf();
   test_tf();
   test_fff();
+  test_key_load();
+  test_key_slot_request();
+  test_key_slot_release();
   puts("All tests passed.");
   return 0;
 }